@@ -0,0 +1,104 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstring>
+
+#if defined(__SSE4_2__) || defined(__AVX__)
+#include <nmmintrin.h>
+#define HASH_CRC32C_SSE42
+
+// _mm_crc32_u64 only exists on 64-bit targets
+#if defined(__x86_64__) || defined(_M_X64)
+#define HASH_CRC32C_SSE42_U64
+#endif
+
+#endif
+
+
+/*  CRC32C (Castagnoli)
+
+    uses the SSE4.2 crc32 instruction when available, 8 bytes at a time (4 on 32-bit targets)
+    otherwise a table, one byte at a time
+    pass the result of the previous call as crc to hash data in several parts
+*/
+
+namespace hash
+{
+    constexpr u32 CRC32C_POLY = 0x82F63B78;
+
+
+    class Crc32cTable
+    {
+    public:
+        u32 values[256];
+
+        constexpr Crc32cTable() : values()
+        {
+            for (u32 i = 0; i < 256; i++)
+            {
+                auto c = i;
+                for (u32 k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+                }
+
+                values[i] = c;
+            }
+        }
+    };
+
+
+    inline constexpr Crc32cTable crc32c_table;
+}
+
+
+namespace hash
+{
+    inline u32 crc32c(u8 const* data, u64 size, u32 crc = 0)
+    {
+        crc = ~crc;
+
+#ifdef HASH_CRC32C_SSE42
+
+#ifdef HASH_CRC32C_SSE42_U64
+
+        u64 c = crc;
+
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            u64 v;
+            std::memcpy(&v, data, 8);
+            c = _mm_crc32_u64(c, v);
+        }
+
+        crc = (u32)c;
+
+#else
+
+        for (; size >= 4; data += 4, size -= 4)
+        {
+            u32 v;
+            std::memcpy(&v, data, 4);
+            crc = _mm_crc32_u32(crc, v);
+        }
+
+#endif
+
+        for (; size; data++, size--)
+        {
+            crc = _mm_crc32_u8(crc, *data);
+        }
+
+#else
+
+        for (; size; data++, size--)
+        {
+            crc = crc32c_table.values[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+        }
+
+#endif
+
+        return ~crc;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "image.hpp"
+#include "trace.hpp"
 
 #define IMAGE_READ
 #define IMAGE_WRITE
@@ -11,6 +12,25 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cctype>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 namespace mem
@@ -30,6 +50,134 @@ namespace mem
 }
 
 
+/* memory mapped files */
+
+namespace mem
+{
+    // screenshots are read whole right away, recordings are read a frame at a time
+    constexpr u64 MAX_READ_AHEAD_SIZE = 16 * 1024 * 1024;
+
+#ifdef _WIN32
+
+    void unmap_file(MappedFile& file)
+    {
+        if (file.data)
+        {
+            UnmapViewOfFile(file.data);
+        }
+
+        if (file.h_map)
+        {
+            CloseHandle(file.h_map);
+        }
+
+        if (file.h_file)
+        {
+            CloseHandle(file.h_file);
+        }
+
+        file = {};
+    }
+
+
+    bool map_file(MappedFile& file, const char* path)
+    {
+        auto h_file = CreateFileA(
+            path,
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+            NULL);
+
+        if (h_file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        file.h_file = h_file;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file.h_file, &size) || size.QuadPart <= 0)
+        {
+            unmap_file(file);
+            return false;
+        }
+
+        file.h_map = CreateFileMappingA(file.h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!file.h_map)
+        {
+            unmap_file(file);
+            return false;
+        }
+
+        file.data = (u8 const*)MapViewOfFile(file.h_map, FILE_MAP_READ, 0, 0, 0);
+        if (!file.data)
+        {
+            unmap_file(file);
+            return false;
+        }
+
+        file.size = (u64)size.QuadPart;
+
+        return true;
+    }
+
+#else
+
+    void unmap_file(MappedFile& file)
+    {
+        if (file.data)
+        {
+            munmap((void*)file.data, file.size);
+        }
+
+        file = {};
+    }
+
+
+    bool map_file(MappedFile& file, const char* path)
+    {
+        auto fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        auto data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        // one advice per call
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+        if ((u64)st.st_size <= MAX_READ_AHEAD_SIZE)
+        {
+            madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+        }
+
+        file.data = (u8 const*)data;
+        file.size = (u64)st.st_size;
+
+        return true;
+    }
+
+#endif
+}
+
+
 namespace image
 {
     bool create_image(Image& image, u32 width, u32 height)
@@ -151,123 +299,1426 @@ namespace image
 }
 
 
-/* read, write, resize */
+/* scale_down */
 
 namespace image
 {
-    static bool has_extension(const char* filename, const char* ext)
+    static inline u8 box_average(u8 a, u8 b, u8 c, u8 d)
+    {
+        return (u8)(((u32)a + b + c + d + 2) >> 2);
+    }
+
+
+    void scale_down_2x(SubView const& src, SubView const& dst)
     {
-        size_t file_length = std::strlen(filename);
-        size_t ext_length = std::strlen(ext);
+        assert(dst.width * 2 <= src.width);
+        assert(dst.height * 2 <= src.height);
 
-        return !std::strcmp(&filename[file_length - ext_length], ext);
+        for (u32 y = 0; y < dst.height; y++)
+        {
+            auto s0 = row_begin(src, 2 * y);
+            auto s1 = row_begin(src, 2 * y + 1);
+            auto d = row_begin(dst, y);
+            for (u32 x = 0; x < dst.width; x++)
+            {
+                auto a = s0[2 * x];
+                auto b = s0[2 * x + 1];
+                auto c = s1[2 * x];
+                auto e = s1[2 * x + 1];
+
+                d[x].red = box_average(a.red, b.red, c.red, e.red);
+                d[x].green = box_average(a.green, b.green, c.green, e.green);
+                d[x].blue = box_average(a.blue, b.blue, c.blue, e.blue);
+                d[x].alpha = box_average(a.alpha, b.alpha, c.alpha, e.alpha);
+            }
+        }
     }
 
 
-    static bool is_bmp(const char* filename)
+    void scale_down_nearest(SubView const& src, u32 scale, SubView const& dst)
     {
-        return has_extension(filename, ".bmp") || has_extension(filename, ".BMP");
+        assert(scale);
+        assert(dst.width * scale <= src.width);
+        assert(dst.height * scale <= src.height);
+
+        auto const half = scale / 2;
+
+        for (u32 y = 0; y < dst.height; y++)
+        {
+            auto s = row_begin(src, y * scale + half) + half;
+            auto d = row_begin(dst, y);
+            for (u32 x = 0; x < dst.width; x++)
+            {
+                d[x] = s[x * scale];
+            }
+        }
     }
+}
+
 
+/* hash */
 
-    static bool is_png(const char* filename)
+namespace image
+{
+    u64 hash(SubView const& view)
     {
-        return has_extension(filename, ".png") || has_extension(filename, ".PNG");
+        // FNV-1a over 32 bit pixels
+        constexpr u64 prime = 0x100000001b3;
+
+        u64 h = 0xcbf29ce484222325;
+        h = (h ^ view.width) * prime;
+        h = (h ^ view.height) * prime;
+
+        for (u32 y = 0; y < view.height; y++)
+        {
+            auto row = (u32*)row_begin(view, y);
+            for (u32 x = 0; x < view.width; x++)
+            {
+                h = (h ^ row[x]) * prime;
+            }
+        }
+
+        return h;
     }
+}
 
 
-    bool read_image_from_file(const char* img_path_src, Image& image_dst)
-	{
-		int width = 0;
-		int height = 0;
-		int image_channels = 0;
-		int desired_channels = 4;
+/* qoi */
 
-		auto data = (Pixel*)stbi_load(img_path_src, &width, &height, &image_channels, desired_channels);
+namespace image
+{
+namespace qoi
+{
+    // https://qoiformat.org/qoi-specification.pdf
 
-		assert(data);
-		assert(width);
-		assert(height);
+    constexpr u8 OP_INDEX = 0x00;
+    constexpr u8 OP_DIFF = 0x40;
+    constexpr u8 OP_LUMA = 0x80;
+    constexpr u8 OP_RUN = 0xc0;
+    constexpr u8 OP_RGB = 0xfe;
+    constexpr u8 OP_RGBA = 0xff;
+    constexpr u8 MASK_2 = 0xc0;
 
-		if (!data)
-		{
-			return false;
-		}
+    constexpr u32 HEADER_SIZE = 14;
+    constexpr u32 MAX_RUN = 62;
 
-		image_dst.data_ = data;
-		image_dst.width = width;
-		image_dst.height = height;
+    constexpr u8 END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
 
-		return true;
-	}
+    constexpr u32 WRITE_BUFFER_SIZE = 64 * 1024;
 
 
-    bool write_to_file(ImageView const& image_src, const char* file_path_dst)
-	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.matrix_data_);
+    static inline u32 to_u32(Pixel p)
+    {
+        u32 value;
+        std::memcpy(&value, &p, sizeof(value));
+        return value;
+    }
 
-		int width = (int)(image_src.width);
-		int height = (int)(image_src.height);
-		int channels = 4;
-		auto const data = image_src.matrix_data_;
 
-		int result = 0;
+    static inline u32 index_position(Pixel p)
+    {
+        return (p.red * 3 + p.green * 5 + p.blue * 7 + p.alpha * 11) % 64;
+    }
 
-		if(is_bmp(file_path_dst))
-		{
-			result = stbi_write_bmp(file_path_dst, width, height, channels, data);
-			assert(result && " *** stbi_write_bmp() failed *** ");
-		}
-		else if(is_png(file_path_dst))
-		{
-			int stride_in_bytes = width * channels;
 
-			result = stbi_write_png(file_path_dst, width, height, channels, data, stride_in_bytes);
-			assert(result && " *** stbi_write_png() failed *** ");
-		}
-		else
-		{
-			assert(false && " *** not a valid image format *** ");
-		}
+    static inline u32 read_u32_be(u8 const* src)
+    {
+        return ((u32)src[0] << 24) | ((u32)src[1] << 16) | ((u32)src[2] << 8) | src[3];
+    }
 
-		return (bool)result;
-	}
 
+    static inline void write_u32_be(u8* dst, u32 value)
+    {
+        dst[0] = (u8)(value >> 24);
+        dst[1] = (u8)(value >> 16);
+        dst[2] = (u8)(value >> 8);
+        dst[3] = (u8)value;
+    }
 
-    bool resize(ImageView const& image_src, ImageView& image_dst)
-	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.matrix_data_);
-		assert(image_dst.width);
-		assert(image_dst.height);
 
-		int channels = 4;
+    // number of pixels from begin that are equal to value
+    static inline u32 span_equal(u32 const* row, u32 begin, u32 end, u32 value)
+    {
+        u32 x = begin;
 
-		auto layout = stbir_pixel_layout::STBIR_RGBA;
+    #ifdef __SSE2__
 
-		int width_src = (int)(image_src.width);
-		int height_src = (int)(image_src.height);
-		int stride_bytes_src = width_src * channels;
+        auto const v = _mm_set1_epi32((int)value);
+        for (; x + 4 <= end; x += 4)
+        {
+            auto p = _mm_loadu_si128((__m128i const*)(row + x));
+            auto mask = _mm_movemask_epi8(_mm_cmpeq_epi32(p, v));
+            if (mask != 0xffff)
+            {
+                break;
+            }
+        }
 
-		int width_dst = (int)(image_dst.width);
-		int height_dst = (int)(image_dst.height);
-		int stride_bytes_dst = width_dst * channels;
+    #endif
 
-		auto data = stbir_resize_uint8_linear(
-			(u8*)image_src.matrix_data_, width_src, height_src, stride_bytes_src,
-			(u8*)image_dst.matrix_data_, width_dst, height_dst, stride_bytes_dst,
-			layout);
+        for (; x < end && row[x] == value; x++)
+        {
+        }
 
-		assert(data && " *** resize_image failed *** ");
+        return x - begin;
+    }
 
-		if (!image_dst.matrix_data_)
-		{
-			image_dst.matrix_data_ = (Pixel*)data;
-		}
 
-		return (bool)data;
+    static bool is_qoi(u8 const* bytes, u64 size)
+    {
+        return size >= HEADER_SIZE && bytes[0] == 'q' && bytes[1] == 'o' && bytes[2] == 'i' && bytes[3] == 'f';
+    }
+
+
+    static bool decode(u8 const* bytes, u64 size, Image& image_dst)
+    {
+        if (!is_qoi(bytes, size))
+        {
+            return false;
+        }
+
+        auto width = read_u32_be(bytes + 4);
+        auto height = read_u32_be(bytes + 8);
+        auto channels = bytes[12];
+
+        if (!width || !height || (channels != 3 && channels != 4) || (u64)width * height > 0x7fffffff / 4)
+        {
+            return false;
+        }
+
+        auto data = mem::alloc<Pixel>(width * height);
+        if (!data)
+        {
+            return false;
+        }
+
+        Pixel index[64] = {};
+        auto px = to_pixel(0, 0, 0, 255);
+
+        auto const n_pixels = width * height;
+        auto const chunks_end = size - sizeof(END_MARKER);
+        u64 pos = HEADER_SIZE;
+        u32 i = 0;
+
+        while (i < n_pixels && pos < chunks_end)
+        {
+            auto b1 = bytes[pos++];
+
+            if (b1 == OP_RGB)
+            {
+                px.red = bytes[pos];
+                px.green = bytes[pos + 1];
+                px.blue = bytes[pos + 2];
+                pos += 3;
+            }
+            else if (b1 == OP_RGBA)
+            {
+                px.red = bytes[pos];
+                px.green = bytes[pos + 1];
+                px.blue = bytes[pos + 2];
+                px.alpha = bytes[pos + 3];
+                pos += 4;
+            }
+            else if ((b1 & MASK_2) == OP_INDEX)
+            {
+                px = index[b1];
+            }
+            else if ((b1 & MASK_2) == OP_DIFF)
+            {
+                px.red += ((b1 >> 4) & 0x03) - 2;
+                px.green += ((b1 >> 2) & 0x03) - 2;
+                px.blue += (b1 & 0x03) - 2;
+            }
+            else if ((b1 & MASK_2) == OP_LUMA)
+            {
+                auto b2 = bytes[pos++];
+                int vg = (b1 & 0x3f) - 32;
+                px.red += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.green += vg;
+                px.blue += vg - 8 + (b2 & 0x0f);
+            }
+            else // OP_RUN
+            {
+                auto run = std::min((u32)(b1 & 0x3f) + 1, n_pixels - i);
+                for (u32 r = 0; r < run; r++)
+                {
+                    data[i + r] = px;
+                }
+
+                i += run;
+                continue;
+            }
+
+            index[index_position(px)] = px;
+            data[i++] = px;
+        }
+
+        if (i < n_pixels)
+        {
+            mem::free(data);
+            return false;
+        }
+
+        image_dst.data_ = data;
+        image_dst.width = width;
+        image_dst.height = height;
+
+        return true;
+    }
+
+
+    class Writer
+    {
+    public:
+        FILE* file = nullptr;
+        u8* buffer = nullptr;
+        u32 size = 0;
+        bool ok = true;
+    };
+
+
+    static inline void flush(Writer& w)
+    {
+        if (w.size)
+        {
+            w.ok &= std::fwrite(w.buffer, 1, w.size, w.file) == w.size;
+            w.size = 0;
+        }
+    }
+
+
+    // room for the largest chunk
+    static inline u8* reserve(Writer& w)
+    {
+        if (w.size + 8 > WRITE_BUFFER_SIZE)
+        {
+            flush(w);
+        }
+
+        return w.buffer + w.size;
+    }
+
+
+    static inline void write_run(Writer& w, u32 run)
+    {
+        while (run)
+        {
+            auto n = std::min(run, MAX_RUN);
+            reserve(w)[0] = OP_RUN | (u8)(n - 1);
+            w.size++;
+            run -= n;
+        }
+    }
+
+
+    static bool encode(SubView const& view_src, FILE* file)
+    {
+        Writer w{};
+        w.file = file;
+        w.buffer = mem::alloc<u8>(WRITE_BUFFER_SIZE);
+        if (!w.buffer)
+        {
+            return false;
+        }
+
+        auto h = w.buffer;
+        h[0] = 'q';
+        h[1] = 'o';
+        h[2] = 'i';
+        h[3] = 'f';
+        write_u32_be(h + 4, view_src.width);
+        write_u32_be(h + 8, view_src.height);
+        h[12] = 4; // RGBA
+        h[13] = 0; // sRGB with linear alpha
+        w.size = HEADER_SIZE;
+
+        Pixel index[64] = {};
+        auto prev = to_pixel(0, 0, 0, 255);
+        u32 run = 0;
+
+        for (u32 y = 0; y < view_src.height; y++)
+        {
+            auto row = row_begin(view_src, y);
+            auto row_u32 = (u32 const*)row;
+
+            u32 x = 0;
+            while (x < view_src.width)
+            {
+                // runs are long in pixel art, scan them 4 pixels at a time
+                auto span = span_equal(row_u32, x, view_src.width, to_u32(prev));
+                if (span)
+                {
+                    run += span;
+                    x += span;
+                    continue;
+                }
+
+                write_run(w, run);
+                run = 0;
+
+                auto px = row[x++];
+                auto pos = index_position(px);
+                auto dst = reserve(w);
+
+                if (to_u32(index[pos]) == to_u32(px))
+                {
+                    dst[0] = OP_INDEX | (u8)pos;
+                    w.size += 1;
+                }
+                else
+                {
+                    index[pos] = px;
+
+                    if (px.alpha == prev.alpha)
+                    {
+                        i8 vr = (i8)(px.red - prev.red);
+                        i8 vg = (i8)(px.green - prev.green);
+                        i8 vb = (i8)(px.blue - prev.blue);
+
+                        i8 vg_r = (i8)(vr - vg);
+                        i8 vg_b = (i8)(vb - vg);
+
+                        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                        {
+                            dst[0] = OP_DIFF | (u8)((vr + 2) << 4) | (u8)((vg + 2) << 2) | (u8)(vb + 2);
+                            w.size += 1;
+                        }
+                        else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                        {
+                            dst[0] = OP_LUMA | (u8)(vg + 32);
+                            dst[1] = (u8)((vg_r + 8) << 4) | (u8)(vg_b + 8);
+                            w.size += 2;
+                        }
+                        else
+                        {
+                            dst[0] = OP_RGB;
+                            dst[1] = px.red;
+                            dst[2] = px.green;
+                            dst[3] = px.blue;
+                            w.size += 4;
+                        }
+                    }
+                    else
+                    {
+                        dst[0] = OP_RGBA;
+                        dst[1] = px.red;
+                        dst[2] = px.green;
+                        dst[3] = px.blue;
+                        dst[4] = px.alpha;
+                        w.size += 5;
+                    }
+                }
+
+                prev = px;
+            }
+        }
+
+        write_run(w, run);
+
+        std::memcpy(reserve(w), END_MARKER, sizeof(END_MARKER));
+        w.size += sizeof(END_MARKER);
+
+        flush(w);
+        mem::free(w.buffer);
+
+        return w.ok;
+    }
+}
+}
+
+
+/* formats */
+
+namespace image
+{
+    class FormatInfo
+    {
+    public:
+        ImageFormat format;
+        cstr extension;
+
+        u8 magic[8];
+        u32 magic_size;
+    };
+
+
+    static constexpr FormatInfo FORMAT_REGISTRY[] = {
+        { ImageFormat::PNG, ".png", { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A }, 8 },
+        { ImageFormat::BMP, ".bmp", { 'B', 'M' }, 2 },
+        { ImageFormat::QOI, ".qoi", { 'q', 'o', 'i', 'f' }, 4 },
+        { ImageFormat::PAM, ".pam", { 'P', '7', '\n' }, 3 },
+    };
+
+
+    ImageFormat format_from_bytes(u8 const* bytes, u64 size)
+    {
+        for (auto const& info : FORMAT_REGISTRY)
+        {
+            if (size >= info.magic_size && !std::memcmp(bytes, info.magic, info.magic_size))
+            {
+                return info.format;
+            }
+        }
+
+        return ImageFormat::Unknown;
+    }
+
+
+    ImageFormat format_from_extension(const char* filename)
+    {
+        auto file_length = std::strlen(filename);
+
+        for (auto const& info : FORMAT_REGISTRY)
+        {
+            auto ext_length = std::strlen(info.extension);
+            if (file_length < ext_length)
+            {
+                continue;
+            }
+
+            auto ext = filename + file_length - ext_length;
+
+            bool match = true;
+            for (u32 i = 0; i < ext_length && match; i++)
+            {
+                match = std::tolower((unsigned char)ext[i]) == info.extension[i];
+            }
+
+            if (match)
+            {
+                return info.format;
+            }
+        }
+
+        return ImageFormat::Unknown;
+    }
+}
+
+
+/* bmp */
+
+namespace image
+{
+namespace bmp
+{
+    static inline u16 read_u16(u8 const* src)
+    {
+        return (u16)(src[0] | (src[1] << 8));
+    }
+
+
+    static inline u32 read_u32(u8 const* src)
+    {
+        return (u32)read_u16(src) | ((u32)read_u16(src + 2) << 16);
+    }
+
+
+    // uncompressed 24 and 32 bit bitmaps are converted straight from the file bytes
+    static bool decode_direct(u8 const* bytes, u64 size, Image& image_dst)
+    {
+        constexpr u32 BI_RGB = 0;
+        constexpr u32 BI_BITFIELDS = 3;
+
+        if (size < 54)
+        {
+            return false;
+        }
+
+        auto pixel_offset = read_u32(bytes + 10);
+        auto info_size = read_u32(bytes + 14);
+        auto width = (i32)read_u32(bytes + 18);
+        auto height = (i32)read_u32(bytes + 22);
+        auto bpp = read_u16(bytes + 28);
+        auto compression = read_u32(bytes + 30);
+
+        // the whole info header is read, BI_BITFIELDS masks included
+        if (info_size < 40 || 14 + (u64)info_size > size || width <= 0 || height == 0 || (bpp != 24 && bpp != 32))
+        {
+            return false;
+        }
+
+        bool has_alpha = false;
+
+        if (compression == BI_BITFIELDS)
+        {
+            // only the byte order written by stbi_write_bmp and write_bmp
+            if (bpp != 32 || info_size < 56 ||
+                read_u32(bytes + 54) != 0x00ff0000 ||
+                read_u32(bytes + 58) != 0x0000ff00 ||
+                read_u32(bytes + 62) != 0x000000ff)
+            {
+                return false;
+            }
+
+            has_alpha = read_u32(bytes + 66) == 0xff000000;
+        }
+        else if (compression != BI_RGB)
+        {
+            return false;
+        }
+
+        bool bottom_up = height > 0;
+        u32 w = (u32)width;
+        u32 h = (u32)(bottom_up ? height : -height);
+
+        u32 bytes_per_pixel = bpp / 8;
+        u64 stride = ((u64)w * bytes_per_pixel + 3) & ~(u64)3;
+
+        if (pixel_offset + stride * h > size || (u64)w * h > 0x7fffffff / 4)
+        {
+            return false;
+        }
+
+        auto data = mem::alloc<Pixel>(w * h);
+        if (!data)
+        {
+            return false;
+        }
+
+        for (u32 y = 0; y < h; y++)
+        {
+            auto src = bytes + pixel_offset + stride * (bottom_up ? h - 1 - y : y);
+            auto dst = data + (u64)y * w;
+
+            for (u32 x = 0; x < w; x++)
+            {
+                dst[x].blue = src[0];
+                dst[x].green = src[1];
+                dst[x].red = src[2];
+                dst[x].alpha = has_alpha ? src[3] : 255;
+                src += bytes_per_pixel;
+            }
+        }
+
+        image_dst.data_ = data;
+        image_dst.width = w;
+        image_dst.height = h;
+
+        return true;
+    }
+}
+}
+
+
+/* pam */
+
+namespace image
+{
+namespace pam
+{
+    // http://netpbm.sourceforge.net/doc/pam.html
+
+    bool read_header(u8 const* bytes, u64 size, Header& header)
+    {
+        if (size < 3 || bytes[0] != 'P' || bytes[1] != '7' || bytes[2] != '\n')
+        {
+            return false;
+        }
+
+        u64 pos = 3;
+
+        auto const is_space = [](u8 c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+
+        auto const skip_line = [&]()
+        {
+            while (pos < size && bytes[pos] != '\n')
+            {
+                pos++;
+            }
+
+            pos++;
+        };
+
+        auto const read_number = [&](u32& value)
+        {
+            while (pos < size && (bytes[pos] == ' ' || bytes[pos] == '\t'))
+            {
+                pos++;
+            }
+
+            value = 0;
+            u32 n_digits = 0;
+            while (pos < size && bytes[pos] >= '0' && bytes[pos] <= '9' && n_digits < 9)
+            {
+                value = value * 10 + (bytes[pos++] - '0');
+                n_digits++;
+            }
+
+            return n_digits > 0;
+        };
+
+        auto const match = [&](const char* token)
+        {
+            auto len = std::strlen(token);
+            if (pos + len > size || std::memcmp(bytes + pos, token, len))
+            {
+                return false;
+            }
+
+            pos += len;
+            return true;
+        };
+
+        while (pos < size)
+        {
+            if (is_space(bytes[pos]))
+            {
+                pos++;
+            }
+            else if (bytes[pos] == '#' || match("TUPLTYPE"))
+            {
+                skip_line();
+            }
+            else if (match("ENDHDR"))
+            {
+                skip_line();
+                break;
+            }
+            else if (match("WIDTH"))
+            {
+                if (!read_number(header.width)) { return false; }
+            }
+            else if (match("HEIGHT"))
+            {
+                if (!read_number(header.height)) { return false; }
+            }
+            else if (match("DEPTH"))
+            {
+                if (!read_number(header.depth)) { return false; }
+            }
+            else if (match("MAXVAL"))
+            {
+                if (!read_number(header.maxval)) { return false; }
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        if (pos > size || !header.width || !header.height || header.depth < 1 || header.depth > 4 || header.maxval != 255)
+        {
+            return false;
+        }
+
+        header.size = (u32)pos;
+
+        return true;
+    }
+
+
+    // 1: GRAYSCALE, 2: GRAYSCALE_ALPHA, 3: RGB, 4: RGB_ALPHA
+    static void convert_row(u8 const* src, Pixel* dst, u32 width, u32 depth)
+    {
+        switch (depth)
+        {
+        case 1:
+            for (u32 x = 0; x < width; x++, src += 1) { dst[x] = to_pixel(src[0]); }
+            break;
+
+        case 2:
+            for (u32 x = 0; x < width; x++, src += 2) { dst[x] = to_pixel(src[0], src[0], src[0], src[1]); }
+            break;
+
+        case 3:
+            for (u32 x = 0; x < width; x++, src += 3) { dst[x] = to_pixel(src[0], src[1], src[2]); }
+            break;
+
+        default:
+            std::memcpy(dst, src, width * sizeof(Pixel));
+            break;
+        }
+    }
+
+
+    bool read_pixels(u8 const* bytes, Header const& header, ImageView const& dst)
+    {
+        if (dst.width != header.width || dst.height != header.height)
+        {
+            return false;
+        }
+
+        u64 stride = (u64)header.width * header.depth;
+
+        for (u32 y = 0; y < header.height; y++)
+        {
+            convert_row(bytes + stride * y, row_begin(dst, y), header.width, header.depth);
+        }
+
+        return true;
+    }
+
+
+    static bool decode(u8 const* bytes, u64 size, Image& image_dst)
+    {
+        Header header{};
+        if (!read_header(bytes, size, header))
+        {
+            return false;
+        }
+
+        auto w = header.width;
+        auto h = header.height;
+        u64 stride = (u64)w * header.depth;
+
+        if (header.size + stride * h > size || (u64)w * h > 0x7fffffff / 4)
+        {
+            return false;
+        }
+
+        auto data = mem::alloc<Pixel>(w * h);
+        if (!data)
+        {
+            return false;
+        }
+
+        for (u32 y = 0; y < h; y++)
+        {
+            convert_row(bytes + header.size + stride * y, data + (u64)y * w, w, header.depth);
+        }
+
+        image_dst.data_ = data;
+        image_dst.width = w;
+        image_dst.height = h;
+
+        return true;
+    }
+}
+}
+
+
+/* y4m */
+
+namespace image
+{
+namespace y4m
+{
+    // https://wiki.multimedia.cx/index.php/YUV4MPEG2
+
+    bool read_header(u8 const* bytes, u64 size, Header& header)
+    {
+        constexpr cstr magic = "YUV4MPEG2 ";
+        constexpr u64 magic_len = 10;
+
+        if (size < magic_len || std::memcmp(bytes, magic, magic_len))
+        {
+            return false;
+        }
+
+        u64 pos = magic_len;
+
+        auto const token_is = [&](u64 begin, u64 end, cstr value)
+        {
+            auto len = std::strlen(value);
+            return end - begin == len && !std::memcmp(bytes + begin, value, len);
+        };
+
+        auto const read_number = [&](u64 begin, u64 end, u32& value)
+        {
+            value = 0;
+            for (auto i = begin; i < end && i < begin + 9; i++)
+            {
+                if (bytes[i] < '0' || bytes[i] > '9')
+                {
+                    return false;
+                }
+
+                value = value * 10 + (bytes[i] - '0');
+            }
+
+            return end > begin;
+        };
+
+        header.chroma = Chroma::C420;
+
+        while (pos < size && bytes[pos] != '\n')
+        {
+            if (bytes[pos] == ' ')
+            {
+                pos++;
+                continue;
+            }
+
+            auto begin = pos;
+            while (pos < size && bytes[pos] != ' ' && bytes[pos] != '\n')
+            {
+                pos++;
+            }
+
+            auto tag = bytes[begin];
+            begin++;
+
+            if (tag == 'W')
+            {
+                if (!read_number(begin, pos, header.width)) { return false; }
+            }
+            else if (tag == 'H')
+            {
+                if (!read_number(begin, pos, header.height)) { return false; }
+            }
+            else if (tag == 'C')
+            {
+                // chroma siting does not matter for nearest sampling, bit depths above 8 are not supported
+                if (token_is(begin, pos, "420jpeg") || token_is(begin, pos, "420paldv") ||
+                    token_is(begin, pos, "420mpeg2") || token_is(begin, pos, "420"))
+                {
+                    header.chroma = Chroma::C420;
+                }
+                else if (token_is(begin, pos, "444"))
+                {
+                    header.chroma = Chroma::C444;
+                }
+                else if (token_is(begin, pos, "mono"))
+                {
+                    header.chroma = Chroma::Mono;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+
+            // F, I, A and X are not needed
+        }
+
+        if (pos >= size || !header.width || !header.height)
+        {
+            return false;
+        }
+
+        u64 w = header.width;
+        u64 h = header.height;
+
+        switch (header.chroma)
+        {
+        case Chroma::C420:
+            header.frame_size = w * h + 2 * ((w + 1) / 2) * ((h + 1) / 2);
+            break;
+
+        case Chroma::C444:
+            header.frame_size = 3 * w * h;
+            break;
+
+        default:
+            header.frame_size = w * h;
+            break;
+        }
+
+        header.size = (u32)(pos + 1);
+
+        return true;
+    }
+
+
+    u32 frame_header_size(u8 const* bytes, u64 size)
+    {
+        constexpr u64 tag_len = 5;
+
+        if (size < tag_len + 1 || std::memcmp(bytes, "FRAME", tag_len))
+        {
+            return 0;
+        }
+
+        // frame parameters are ignored
+        for (u64 pos = tag_len; pos < size && pos < 1024; pos++)
+        {
+            if (bytes[pos] == '\n')
+            {
+                return (u32)(pos + 1);
+            }
+        }
+
+        return 0;
+    }
+
+
+    static inline u8 clamp_u8(i32 value)
+    {
+        return (u8)(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+
+
+#ifdef __SSE2__
+
+    // 8 pixels, products of 16 bit pairs are summed to 32 bit by madd, the results match the scalar loop
+    static inline void convert_8(u8 const* y_row, u8 const* u_row, u8 const* v_row, u32 x, u32 c_shift, Pixel* dst)
+    {
+        auto const zero = _mm_setzero_si128();
+
+        auto yv = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(y_row + x)), zero);
+
+        __m128i uv;
+        __m128i vv;
+
+        if (c_shift)
+        {
+            // 4 chroma samples, each one for two pixels
+            i32 u4;
+            i32 v4;
+            std::memcpy(&u4, u_row + (x >> 1), 4);
+            std::memcpy(&v4, v_row + (x >> 1), 4);
+
+            uv = _mm_cvtsi32_si128(u4);
+            vv = _mm_cvtsi32_si128(v4);
+            uv = _mm_unpacklo_epi8(uv, uv);
+            vv = _mm_unpacklo_epi8(vv, vv);
+        }
+        else
+        {
+            uv = _mm_loadl_epi64((__m128i const*)(u_row + x));
+            vv = _mm_loadl_epi64((__m128i const*)(v_row + x));
+        }
+
+        yv = _mm_sub_epi16(yv, _mm_set1_epi16(16));
+        auto d = _mm_sub_epi16(_mm_unpacklo_epi8(uv, zero), _mm_set1_epi16(128));
+        auto e = _mm_sub_epi16(_mm_unpacklo_epi8(vv, zero), _mm_set1_epi16(128));
+        auto one = _mm_set1_epi16(1);
+
+        auto const k_r = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+        auto const k_g = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+        auto const k_g2 = _mm_setr_epi16(-208, 128, -208, 128, -208, 128, -208, 128);
+        auto const k_b = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+        auto const round = _mm_set1_epi32(128);
+
+        auto const channel = [&](__m128i lo, __m128i hi)
+        {
+            // >> 8, then saturated to i16 and u8 as clamp_u8 does
+            auto v = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+            return _mm_packus_epi16(v, v);
+        };
+
+        auto ye_lo = _mm_unpacklo_epi16(yv, e);
+        auto ye_hi = _mm_unpackhi_epi16(yv, e);
+        auto yd_lo = _mm_unpacklo_epi16(yv, d);
+        auto yd_hi = _mm_unpackhi_epi16(yv, d);
+        auto e1_lo = _mm_unpacklo_epi16(e, one);
+        auto e1_hi = _mm_unpackhi_epi16(e, one);
+
+        auto r = channel(
+            _mm_add_epi32(_mm_madd_epi16(ye_lo, k_r), round),
+            _mm_add_epi32(_mm_madd_epi16(ye_hi, k_r), round));
+
+        // the rounding is in k_g2
+        auto g = channel(
+            _mm_add_epi32(_mm_madd_epi16(yd_lo, k_g), _mm_madd_epi16(e1_lo, k_g2)),
+            _mm_add_epi32(_mm_madd_epi16(yd_hi, k_g), _mm_madd_epi16(e1_hi, k_g2)));
+
+        auto b = channel(
+            _mm_add_epi32(_mm_madd_epi16(yd_lo, k_b), round),
+            _mm_add_epi32(_mm_madd_epi16(yd_hi, k_b), round));
+
+        auto rg = _mm_unpacklo_epi8(r, g);
+        auto ba = _mm_unpacklo_epi8(b, _mm_set1_epi8((char)255));
+
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(rg, ba));
+    }
+
+#endif
+
+
+    // integer BT.601 video range, a gray pixel (u = v = 128) stays gray
+    static void convert_row(u8 const* y_row, u8 const* u_row, u8 const* v_row, u32 x_begin, u32 c_shift, Pixel* dst, u32 width)
+    {
+        u32 i = 0;
+
+    #ifdef __SSE2__
+
+        // chroma pairs must start on an even pixel
+        if (!(x_begin & c_shift))
+        {
+            for (; i + 8 <= width; i += 8)
+            {
+                convert_8(y_row, u_row, v_row, x_begin + i, c_shift, dst + i);
+            }
+        }
+
+    #endif
+
+        for (; i < width; i++)
+        {
+            auto x = x_begin + i;
+            auto c = ((i32)y_row[x] - 16) * 298 + 128;
+            auto d = (i32)u_row[x >> c_shift] - 128;
+            auto e = (i32)v_row[x >> c_shift] - 128;
+
+            dst[i] = to_pixel(
+                clamp_u8((c + 409 * e) >> 8),
+                clamp_u8((c - 100 * d - 208 * e) >> 8),
+                clamp_u8((c + 516 * d) >> 8));
+        }
+    }
+
+
+    void read_pixels(u8 const* planes, Header const& header, Rect2Du32 const& r, SubView const& dst)
+    {
+        u64 w = header.width;
+        u64 h = header.height;
+
+        auto const width = r.x_end - r.x_begin;
+
+        if (header.chroma == Chroma::Mono)
+        {
+            for (u32 y = r.y_begin; y < r.y_end; y++)
+            {
+                auto y_row = planes + w * y;
+                auto d = row_begin(dst, y - r.y_begin);
+
+                for (u32 i = 0; i < width; i++)
+                {
+                    d[i] = to_pixel(clamp_u8((((i32)y_row[r.x_begin + i] - 16) * 298 + 128) >> 8));
+                }
+            }
+
+            return;
+        }
+
+        auto is_420 = header.chroma == Chroma::C420;
+
+        auto c_shift = is_420 ? 1u : 0u;
+        auto c_width = is_420 ? (w + 1) / 2 : w;
+        auto c_height = is_420 ? (h + 1) / 2 : h;
+
+        auto u_plane = planes + w * h;
+        auto v_plane = u_plane + c_width * c_height;
+
+        for (u32 y = r.y_begin; y < r.y_end; y++)
+        {
+            auto y_row = planes + w * y;
+            auto u_row = u_plane + c_width * (y >> c_shift);
+            auto v_row = v_plane + c_width * (y >> c_shift);
+
+            convert_row(y_row, u_row, v_row, r.x_begin, c_shift, row_begin(dst, y - r.y_begin), width);
+        }
+    }
+}
+}
+
+
+/* read, write, resize */
+
+namespace image
+{
+    static bool write_qoi(SubView const& view_src, const char* file_path_dst)
+    {
+        auto file = std::fopen(file_path_dst, "wb");
+        if (!file)
+        {
+            return false;
+        }
+
+        auto result = qoi::encode(view_src, file);
+        std::fclose(file);
+
+        return result;
+    }
+
+
+    static bool read_stbi(u8 const* bytes, u64 size, Image& image_dst)
+	{
+		int width = 0;
+		int height = 0;
+		int image_channels = 0;
+		int desired_channels = 4;
+
+		if (size > 0x7fffffff)
+		{
+			return false;
+		}
+
+		auto data = (Pixel*)stbi_load_from_memory(bytes, (int)size, &width, &height, &image_channels, desired_channels);
+
+		// e.g. a file that is still being written
+		if (!data)
+		{
+			return false;
+		}
+
+		image_dst.data_ = data;
+		image_dst.width = width;
+		image_dst.height = height;
+
+		return true;
+	}
+
+
+    bool read_image_from_memory(u8 const* bytes, u64 size, Image& image_dst)
+	{
+		switch (format_from_bytes(bytes, size))
+		{
+		case ImageFormat::PNG:
+			return read_stbi(bytes, size, image_dst);
+
+		case ImageFormat::BMP:
+			return bmp::decode_direct(bytes, size, image_dst) || read_stbi(bytes, size, image_dst);
+
+		case ImageFormat::QOI:
+			return qoi::decode(bytes, size, image_dst);
+
+		case ImageFormat::PAM:
+			return pam::decode(bytes, size, image_dst);
+
+		default:
+			return false;
+		}
+	}
+
+
+    bool read_image_from_file(const char* img_path_src, Image& image_dst)
+	{
+		mem::MappedFile file;
+		bool mapped = false;
+
+		{
+			// pages are read in by the decode that follows
+			TRACE_SCOPE("file read");
+			mapped = mem::map_file(file, img_path_src);
+		}
+
+		if (!mapped)
+		{
+			return false;
+		}
+
+		TRACE_SCOPE_ARG("decode", file.size);
+
+		auto result = read_image_from_memory(file.data, file.size, image_dst);
+
+		mem::unmap_file(file);
+
+		return result;
+	}
+
+
+    static void write_u16(u8*& dst, u16 value)
+    {
+        dst[0] = (u8)value;
+        dst[1] = (u8)(value >> 8);
+        dst += 2;
+    }
+
+
+    static void write_u32(u8*& dst, u32 value)
+    {
+        write_u16(dst, (u16)value);
+        write_u16(dst, (u16)(value >> 16));
+    }
+
+
+    static bool write_bmp(SubView const& view_src, const char* file_path_dst)
+    {
+        // 32 bit BI_BITFIELDS with a V4 header, same layout as stbi_write_bmp
+        constexpr u32 file_header_size = 14;
+        constexpr u32 info_header_size = 108;
+        constexpr u32 header_size = file_header_size + info_header_size;
+
+        u32 const row_bytes = view_src.width * 4;
+        u32 const image_bytes = row_bytes * view_src.height;
+
+        u8 header[header_size] = { 0 };
+        auto h = header;
+
+        write_u16(h, 0x4D42); // 'BM'
+        write_u32(h, header_size + image_bytes);
+        write_u32(h, 0);
+        write_u32(h, header_size);
+
+        write_u32(h, info_header_size);
+        write_u32(h, view_src.width);
+        write_u32(h, view_src.height); // bottom-up
+        write_u16(h, 1);
+        write_u16(h, 32);
+        write_u32(h, 3); // BI_BITFIELDS
+        write_u32(h, image_bytes);
+        write_u32(h, 0);
+        write_u32(h, 0);
+        write_u32(h, 0);
+        write_u32(h, 0);
+        write_u32(h, 0x00ff0000);
+        write_u32(h, 0x0000ff00);
+        write_u32(h, 0x000000ff);
+        write_u32(h, 0xff000000);
+
+        auto row = mem::alloc<u8>(row_bytes);
+        if (!row)
+        {
+            return false;
+        }
+
+        auto file = std::fopen(file_path_dst, "wb");
+        if (!file)
+        {
+            mem::free(row);
+            return false;
+        }
+
+        bool result = std::fwrite(header, 1, header_size, file) == header_size;
+
+        for (u32 y = view_src.height; y > 0 && result; y--)
+        {
+            auto src = row_begin(view_src, y - 1);
+            auto dst = row;
+            for (u32 x = 0; x < view_src.width; x++)
+            {
+                auto p = src[x];
+                dst[0] = p.blue;
+                dst[1] = p.green;
+                dst[2] = p.red;
+                dst[3] = p.alpha;
+                dst += 4;
+            }
+
+            result = std::fwrite(row, 1, row_bytes, file) == row_bytes;
+        }
+
+        std::fclose(file);
+        mem::free(row);
+
+        return result;
+    }
+
+
+    bool write_to_file(ImageView const& image_src, const char* file_path_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.matrix_data_);
+
+		return write_to_file(sub_view(image_src), file_path_dst);
+	}
+
+
+    bool write_to_file(SubView const& view_src, const char* file_path_dst)
+	{
+		assert(view_src.width);
+		assert(view_src.height);
+		assert(view_src.matrix_data_);
+
+		int width = (int)(view_src.width);
+		int height = (int)(view_src.height);
+		int channels = 4;
+		auto const data = row_begin(view_src, 0);
+
+		int result = 0;
+
+		auto format = format_from_extension(file_path_dst);
+
+		if(format == ImageFormat::BMP)
+		{
+			result = write_bmp(view_src, file_path_dst);
+			assert(result && " *** write_bmp() failed *** ");
+		}
+		else if(format == ImageFormat::PNG)
+		{
+			int stride_in_bytes = (int)(view_src.matrix_width * channels);
+
+			result = stbi_write_png(file_path_dst, width, height, channels, data, stride_in_bytes);
+			assert(result && " *** stbi_write_png() failed *** ");
+		}
+		else if(format == ImageFormat::QOI)
+		{
+			result = write_qoi(view_src, file_path_dst);
+			assert(result && " *** write_qoi() failed *** ");
+		}
+		else
+		{
+			assert(false && " *** not a valid image format *** ");
+		}
+
+		return (bool)result;
+	}
+
+
+    bool resize(ImageView const& image_src, ImageView& image_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.matrix_data_);
+		assert(image_dst.width);
+		assert(image_dst.height);
+
+		int channels = 4;
+
+		auto layout = stbir_pixel_layout::STBIR_RGBA;
+
+		int width_src = (int)(image_src.width);
+		int height_src = (int)(image_src.height);
+		int stride_bytes_src = width_src * channels;
+
+		int width_dst = (int)(image_dst.width);
+		int height_dst = (int)(image_dst.height);
+		int stride_bytes_dst = width_dst * channels;
+
+		auto data = stbir_resize_uint8_linear(
+			(u8*)image_src.matrix_data_, width_src, height_src, stride_bytes_src,
+			(u8*)image_dst.matrix_data_, width_dst, height_dst, stride_bytes_dst,
+			layout);
+
+		assert(data && " *** resize_image failed *** ");
+
+		if (!image_dst.matrix_data_)
+		{
+			image_dst.matrix_data_ = (Pixel*)data;
+		}
+
+		return (bool)data;
+	}
+
+
+    bool resize(ImageView const& image_src, ImageView const& image_dst, Rect2Du32 const& dst_range)
+	{
+		assert(image_dst.matrix_data_);
+
+		Vec2Du32 dst_dim = { image_dst.width, image_dst.height };
+
+		return resize(image_src, dst_dim, dst_range, sub_view(image_dst, dst_range));
+	}
+
+
+    bool resize(ImageView const& image_src, Vec2Du32 dst_dim, Rect2Du32 const& dst_range, SubView const& view_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.matrix_data_);
+		assert(view_dst.matrix_data_);
+		assert(dst_range.x_end <= dst_dim.x);
+		assert(dst_range.y_end <= dst_dim.y);
+		assert(view_dst.width == dst_range.x_end - dst_range.x_begin);
+		assert(view_dst.height == dst_range.y_end - dst_range.y_begin);
+
+		int channels = 4;
+
+		auto layout = stbir_pixel_layout::STBIR_RGBA;
+
+		int width_src = (int)(image_src.width);
+		int height_src = (int)(image_src.height);
+		int stride_bytes_src = width_src * channels;
+
+		int width_dst = (int)(view_dst.width);
+		int height_dst = (int)(view_dst.height);
+		int stride_bytes_dst = (int)(view_dst.matrix_width * channels);
+
+		STBIR_RESIZE resize;
+		stbir_resize_init(&resize,
+			(u8*)image_src.matrix_data_, width_src, height_src, stride_bytes_src,
+			(u8*)row_begin(view_dst, 0), width_dst, height_dst, stride_bytes_dst,
+			layout, STBIR_TYPE_UINT8);
+
+		// the part of the source that lands in dst_range, sampled the same as a full resize
+		auto s0 = (f64)dst_range.x_begin / dst_dim.x;
+		auto t0 = (f64)dst_range.y_begin / dst_dim.y;
+		auto s1 = (f64)dst_range.x_end / dst_dim.x;
+		auto t1 = (f64)dst_range.y_end / dst_dim.y;
+
+		if (!stbir_set_input_subrect(&resize, s0, t0, s1, t1))
+		{
+			return false;
+		}
+
+		auto result = stbir_resize_extended(&resize);
+
+		assert(result && " *** resize_image failed *** ");
+
+		return (bool)result;
 	}
 }
\ No newline at end of file
@@ -3,6 +3,31 @@
 #include "types.hpp"
 
 
+/* memory mapped files */
+
+namespace mem
+{
+    class MappedFile
+    {
+    public:
+        u8 const* data = nullptr;
+        u64 size = 0;
+
+    #ifdef _WIN32
+        // HANDLEs
+        void* h_file = nullptr;
+        void* h_map = nullptr;
+    #endif
+    };
+
+
+    // read only
+    bool map_file(MappedFile& file, const char* path);
+
+    void unmap_file(MappedFile& file);
+}
+
+
 /*  image basic */
 
 namespace image
@@ -186,7 +211,7 @@ namespace image
     template <typename T>
     inline MatrixSubView2D<T> sub_view(MatrixView2D<T> const& view)
     {
-        auto range = make_range(view.width, view.height);
+        auto range = make_rect(view.width, view.height);
         return sub_view(view, range);
     }
 }
@@ -212,13 +237,132 @@ namespace image
 }
 
 
+/* scale_down */
+
+namespace image
+{
+    void scale_down_2x(SubView const& src, SubView const& dst);
+
+    // each dst pixel is the src pixel at the center of its scale x scale block
+    void scale_down_nearest(SubView const& src, u32 scale, SubView const& dst);
+}
+
+
+/* hash */
+
+namespace image
+{
+    u64 hash(SubView const& view);
+}
+
+
+/* formats */
+
+namespace image
+{
+    enum class ImageFormat : int
+    {
+        Unknown = 0,
+        PNG,
+        BMP,
+        QOI,
+        PAM
+    };
+
+
+    ImageFormat format_from_bytes(u8 const* bytes, u64 size);
+
+    ImageFormat format_from_extension(const char* filename);
+}
+
+
+/* pam */
+
+namespace image
+{
+namespace pam
+{
+    class Header
+    {
+    public:
+        u32 width = 0;
+        u32 height = 0;
+
+        // 1: GRAYSCALE, 2: GRAYSCALE_ALPHA, 3: RGB, 4: RGB_ALPHA
+        u32 depth = 0;
+        u32 maxval = 0;
+
+        // offset of the first pixel
+        u32 size = 0;
+    };
+
+
+    // bytes must include the ENDHDR line
+    bool read_header(u8 const* bytes, u64 size, Header& header);
+
+    // converts the pixels at bytes, the first one after the header, into dst of the header's size
+    bool read_pixels(u8 const* bytes, Header const& header, ImageView const& dst);
+}
+}
+
+
+/* y4m */
+
+namespace image
+{
+namespace y4m
+{
+    enum class Chroma : int
+    {
+        C420 = 0,
+        C444,
+        Mono
+    };
+
+
+    class Header
+    {
+    public:
+        u32 width = 0;
+        u32 height = 0;
+
+        Chroma chroma = Chroma::C420;
+
+        // offset of the first FRAME line
+        u32 size = 0;
+
+        // bytes of the Y, U and V planes of a frame
+        u64 frame_size = 0;
+    };
+
+
+    // 8 bit 4:2:0, 4:4:4 and mono, bytes must include the whole header line
+    bool read_header(u8 const* bytes, u64 size, Header& header);
+
+    // offset of the planes after the FRAME line at bytes, 0 if bytes is not a FRAME line
+    u32 frame_header_size(u8 const* bytes, u64 size);
+
+    // converts the region r of the frame at planes (BT.601, video range) into dst of r's size
+    void read_pixels(u8 const* planes, Header const& header, Rect2Du32 const& r, SubView const& dst);
+}
+}
+
+
 /* read, write, resize */
 
 namespace image
 {
     bool read_image_from_file(const char* img_path_src, Image& image_dst);
 
+    bool read_image_from_memory(u8 const* bytes, u64 size, Image& image_dst);
+
     bool write_to_file(ImageView const& image_src, const char* file_path_dst);
 
+    bool write_to_file(SubView const& view_src, const char* file_path_dst);
+
     bool resize(ImageView const& image_src, ImageView& image_dst);
+
+    bool resize(ImageView const& image_src, ImageView const& image_dst, Rect2Du32 const& dst_range);
+
+    bool resize(ImageView const& image_src, Vec2Du32 dst_dim, Rect2Du32 const& dst_range, SubView const& view_dst);
 }
\ No newline at end of file
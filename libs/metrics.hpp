@@ -0,0 +1,149 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <atomic>
+#include <cstdio>
+
+
+/*  counters and gauges
+
+    counters only go up and are summed over per-thread shards, adding never contends
+    gauges hold the last value set
+    metrics are registered by name before threads start recording
+*/
+
+namespace metrics
+{
+    constexpr u32 MAX_COUNTERS = 32;
+    constexpr u32 MAX_GAUGES = 16;
+
+    // threads past the last shard share it
+    constexpr u32 MAX_SHARDS = 16;
+
+
+    class Shard
+    {
+    public:
+        alignas(64) std::atomic<u64> values[MAX_COUNTERS];
+    };
+
+
+    class Registry
+    {
+    public:
+        cstr counter_names[MAX_COUNTERS] = { 0 };
+        u32 n_counters = 0;
+
+        cstr gauge_names[MAX_GAUGES] = { 0 };
+        std::atomic<i64> gauges[MAX_GAUGES];
+        u32 n_gauges = 0;
+
+        Shard shards[MAX_SHARDS];
+        std::atomic<u32> n_shards = 0;
+    };
+
+
+    inline Registry registry;
+
+    inline thread_local Shard* thread_shard = nullptr;
+}
+
+
+namespace metrics
+{
+    // name must outlive the registry
+    inline u32 add_counter(cstr name)
+    {
+        if (registry.n_counters == MAX_COUNTERS)
+        {
+            return MAX_COUNTERS - 1;
+        }
+
+        auto id = registry.n_counters++;
+        registry.counter_names[id] = name;
+
+        for (auto& shard : registry.shards)
+        {
+            shard.values[id] = 0;
+        }
+
+        return id;
+    }
+
+
+    inline u32 add_gauge(cstr name)
+    {
+        if (registry.n_gauges == MAX_GAUGES)
+        {
+            return MAX_GAUGES - 1;
+        }
+
+        auto id = registry.n_gauges++;
+        registry.gauge_names[id] = name;
+        registry.gauges[id] = 0;
+
+        return id;
+    }
+
+
+    inline Shard& get_shard()
+    {
+        if (!thread_shard)
+        {
+            auto i = registry.n_shards.fetch_add(1);
+            thread_shard = &registry.shards[i < MAX_SHARDS ? i : MAX_SHARDS - 1];
+        }
+
+        return *thread_shard;
+    }
+
+
+    inline void add(u32 counter, u64 n = 1)
+    {
+        get_shard().values[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+
+    inline void set(u32 gauge, i64 value)
+    {
+        registry.gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+
+    inline u64 read(u32 counter)
+    {
+        u64 sum = 0;
+        for (auto const& shard : registry.shards)
+        {
+            sum += shard.values[counter].load(std::memory_order_relaxed);
+        }
+
+        return sum;
+    }
+
+
+    inline i64 read_gauge(u32 gauge)
+    {
+        return registry.gauges[gauge].load(std::memory_order_relaxed);
+    }
+
+
+    // "name":value pairs of every counter and gauge, to go inside a JSON object
+    inline void write_json_fields(FILE* out)
+    {
+        bool first = true;
+
+        for (u32 i = 0; i < registry.n_counters; i++)
+        {
+            fprintf(out, "%s\"%s\":%llu", first ? "" : ",", registry.counter_names[i], (unsigned long long)read(i));
+            first = false;
+        }
+
+        for (u32 i = 0; i < registry.n_gauges; i++)
+        {
+            fprintf(out, "%s\"%s\":%lld", first ? "" : ",", registry.gauge_names[i], (long long)read_gauge(i));
+            first = false;
+        }
+    }
+}
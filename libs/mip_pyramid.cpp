@@ -0,0 +1,366 @@
+#pragma once
+
+#include "mip_pyramid.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+
+namespace mip
+{
+    static u32 div_ceil(u32 n, u32 d)
+    {
+        return (n + d - 1) / d;
+    }
+
+
+    static bool create_tile_grid(TileGrid& grid, u32 width, u32 height, u32 tile_size)
+    {
+        grid.width = div_ceil(width, tile_size);
+        grid.height = div_ceil(height, tile_size);
+
+        grid.stale = mem::alloc<u8>(grid.width * grid.height);
+        if (!grid.stale)
+        {
+            return false;
+        }
+
+        std::memset(grid.stale, 1, grid.width * grid.height);
+
+        return true;
+    }
+
+
+    static void destroy_tile_grid(TileGrid& grid)
+    {
+        if (grid.stale)
+        {
+            mem::free(grid.stale);
+            grid.stale = nullptr;
+        }
+
+        grid.width = 0;
+        grid.height = 0;
+    }
+
+
+    bool create(Pyramid& pyramid, image::ImageView const& base, u32 tile_size)
+    {
+        assert(base.matrix_data_);
+        assert(tile_size);
+
+        destroy(pyramid);
+
+        pyramid.tile_size = tile_size;
+        pyramid.levels[0] = base;
+        pyramid.tiles[0].width = div_ceil(base.width, tile_size);
+        pyramid.tiles[0].height = div_ceil(base.height, tile_size);
+        pyramid.n_levels = 1;
+
+        for (u32 i = 1; i < MAX_LEVELS; i++)
+        {
+            auto const& prev = pyramid.levels[i - 1];
+            if (prev.width <= tile_size && prev.height <= tile_size)
+            {
+                break;
+            }
+
+            auto width = prev.width / 2;
+            auto height = prev.height / 2;
+            if (!width || !height)
+            {
+                break;
+            }
+
+            if (!image::create_image(pyramid.images[i], width, height))
+            {
+                destroy(pyramid);
+                return false;
+            }
+
+            if (!create_tile_grid(pyramid.tiles[i], width, height, tile_size))
+            {
+                destroy(pyramid);
+                return false;
+            }
+
+            pyramid.levels[i] = image::make_view(pyramid.images[i]);
+            pyramid.n_levels++;
+        }
+
+        return true;
+    }
+
+
+    void destroy(Pyramid& pyramid)
+    {
+        for (u32 i = 1; i < MAX_LEVELS; i++)
+        {
+            image::destroy_image(pyramid.images[i]);
+            destroy_tile_grid(pyramid.tiles[i]);
+            pyramid.levels[i] = {};
+        }
+
+        pyramid.levels[0] = {};
+        pyramid.tiles[0] = {};
+        pyramid.n_levels = 0;
+
+        if (pyramid.src_x)
+        {
+            mem::free(pyramid.src_x);
+            pyramid.src_x = nullptr;
+        }
+
+        pyramid.src_x_width = 0;
+    }
+}
+
+
+namespace mip
+{
+    Rect2Du32 level_rect(Pyramid const& pyramid, u32 level, Rect2Du32 const& base_rect)
+    {
+        assert(level < pyramid.n_levels);
+
+        auto const& view = pyramid.levels[level];
+        auto const scale = 1u << level;
+
+        Rect2Du32 r{};
+        r.x_begin = std::min(base_rect.x_begin >> level, view.width);
+        r.x_end = std::min(div_ceil(base_rect.x_end, scale), view.width);
+        r.y_begin = std::min(base_rect.y_begin >> level, view.height);
+        r.y_end = std::min(div_ceil(base_rect.y_end, scale), view.height);
+
+        return r;
+    }
+
+
+    Rect2Du32 tile_range(Pyramid const& pyramid, u32 level, Rect2Du32 const& level_rect)
+    {
+        assert(level < pyramid.n_levels);
+
+        auto const& grid = pyramid.tiles[level];
+        auto const size = pyramid.tile_size;
+
+        Rect2Du32 r{};
+        r.x_begin = std::min(level_rect.x_begin / size, grid.width);
+        r.x_end = std::min(div_ceil(level_rect.x_end, size), grid.width);
+        r.y_begin = std::min(level_rect.y_begin / size, grid.height);
+        r.y_end = std::min(div_ceil(level_rect.y_end, size), grid.height);
+
+        return r;
+    }
+
+
+    Rect2Du32 tile_rect(Pyramid const& pyramid, u32 level, u32 tile_x, u32 tile_y)
+    {
+        assert(level < pyramid.n_levels);
+
+        auto const& view = pyramid.levels[level];
+        auto const size = pyramid.tile_size;
+
+        Rect2Du32 r{};
+        r.x_begin = tile_x * size;
+        r.x_end = std::min(r.x_begin + size, view.width);
+        r.y_begin = tile_y * size;
+        r.y_end = std::min(r.y_begin + size, view.height);
+
+        return r;
+    }
+
+
+    image::SubView tile_view(Pyramid const& pyramid, u32 level, u32 tile_x, u32 tile_y)
+    {
+        return image::sub_view(pyramid.levels[level], tile_rect(pyramid, level, tile_x, tile_y));
+    }
+}
+
+
+namespace mip
+{
+    void invalidate(Pyramid& pyramid, Rect2Du32 const& base_rect)
+    {
+        for (u32 i = 1; i < pyramid.n_levels; i++)
+        {
+            auto& grid = pyramid.tiles[i];
+
+            for_each_tile(pyramid, i, base_rect, [&](u32 x, u32 y) { grid.stale[y * grid.width + x] = 1; });
+        }
+    }
+
+
+    void invalidate(Pyramid& pyramid)
+    {
+        auto const& base = pyramid.levels[0];
+
+        invalidate(pyramid, image::make_rect(base.width, base.height));
+    }
+
+
+    void update_tile(Pyramid& pyramid, u32 level, u32 tile_x, u32 tile_y)
+    {
+        if (level == 0 || level >= pyramid.n_levels)
+        {
+            return;
+        }
+
+        auto& grid = pyramid.tiles[level];
+        auto& stale = grid.stale[tile_y * grid.width + tile_x];
+        if (!stale)
+        {
+            return;
+        }
+
+        // the four tiles of the previous level under this one
+        auto const& src_grid = pyramid.tiles[level - 1];
+        auto src_x_end = std::min(2 * tile_x + 2, src_grid.width);
+        auto src_y_end = std::min(2 * tile_y + 2, src_grid.height);
+
+        for (u32 y = 2 * tile_y; y < src_y_end; y++)
+        {
+            for (u32 x = 2 * tile_x; x < src_x_end; x++)
+            {
+                update_tile(pyramid, level - 1, x, y);
+            }
+        }
+
+        auto dst_r = tile_rect(pyramid, level, tile_x, tile_y);
+
+        Rect2Du32 src_r{};
+        src_r.x_begin = 2 * dst_r.x_begin;
+        src_r.x_end = 2 * dst_r.x_end;
+        src_r.y_begin = 2 * dst_r.y_begin;
+        src_r.y_end = 2 * dst_r.y_end;
+
+        auto src = image::sub_view(pyramid.levels[level - 1], src_r);
+        auto dst = image::sub_view(pyramid.levels[level], dst_r);
+
+        image::scale_down_2x(src, dst);
+
+        stale = 0;
+    }
+
+
+    void update(Pyramid& pyramid)
+    {
+        for (u32 i = 1; i < pyramid.n_levels; i++)
+        {
+            auto const& grid = pyramid.tiles[i];
+            for (u32 y = 0; y < grid.height; y++)
+            {
+                for (u32 x = 0; x < grid.width; x++)
+                {
+                    update_tile(pyramid, i, x, y);
+                }
+            }
+        }
+    }
+}
+
+
+namespace mip
+{
+    // coarsest level that is still minified at most 2x when shown at zoom
+    u32 view_level(Pyramid const& pyramid, f32 zoom)
+    {
+        u32 level = 0;
+        while (level + 1 < pyramid.n_levels && zoom * (f32)(1u << (level + 1)) <= 1.0f)
+        {
+            level++;
+        }
+
+        return level;
+    }
+
+
+    /*  nearest sample of the base region starting at (x, y), zoom dst pixels per base pixel
+        only the tiles under the region are brought up to date
+        dst pixels outside of the base image are black
+    */
+    void render_view(Pyramid& pyramid, f32 x, f32 y, f32 zoom, image::SubView const& dst)
+    {
+        assert(pyramid.n_levels);
+        assert(zoom > 0.0f);
+
+        auto const level = view_level(pyramid, zoom);
+        auto const& base = pyramid.levels[0];
+        auto const& view = pyramid.levels[level];
+
+        Rect2Du32 base_r{};
+        base_r.x_begin = (u32)std::clamp(std::floor(x), 0.0f, (f32)base.width);
+        base_r.x_end = (u32)std::clamp(std::ceil(x + dst.width / zoom), 0.0f, (f32)base.width);
+        base_r.y_begin = (u32)std::clamp(std::floor(y), 0.0f, (f32)base.height);
+        base_r.y_end = (u32)std::clamp(std::ceil(y + dst.height / zoom), 0.0f, (f32)base.height);
+
+        auto range = tile_range(pyramid, level, level_rect(pyramid, level, base_r));
+
+        for (u32 ty = range.y_begin; ty < range.y_end; ty++)
+        {
+            for (u32 tx = range.x_begin; tx < range.x_end; tx++)
+            {
+                update_tile(pyramid, level, tx, ty);
+            }
+        }
+
+        constexpr u32 OUTSIDE = (u32)-1;
+
+        auto const black = image::to_pixel(0);
+
+        auto const to_level = [&](f32 base_pos, u32 base_size, u32 level_size)
+        {
+            if (base_pos < 0.0f || base_pos >= (f32)base_size)
+            {
+                return OUTSIDE;
+            }
+
+            return std::min((u32)base_pos >> level, level_size - 1);
+        };
+
+        if (pyramid.src_x_width != dst.width)
+        {
+            if (pyramid.src_x)
+            {
+                mem::free(pyramid.src_x);
+            }
+
+            pyramid.src_x = mem::alloc<u32>(dst.width);
+            pyramid.src_x_width = pyramid.src_x ? dst.width : 0;
+        }
+
+        auto src_x = pyramid.src_x;
+        if (!src_x)
+        {
+            image::fill(dst, black);
+            return;
+        }
+
+        for (u32 dx = 0; dx < dst.width; dx++)
+        {
+            src_x[dx] = to_level(x + (dx + 0.5f) / zoom, base.width, view.width);
+        }
+
+        for (u32 dy = 0; dy < dst.height; dy++)
+        {
+            auto d = image::row_begin(dst, dy);
+
+            auto sy = to_level(y + (dy + 0.5f) / zoom, base.height, view.height);
+            if (sy == OUTSIDE)
+            {
+                for (u32 dx = 0; dx < dst.width; dx++)
+                {
+                    d[dx] = black;
+                }
+
+                continue;
+            }
+
+            auto s = image::row_begin(view, sy);
+            for (u32 dx = 0; dx < dst.width; dx++)
+            {
+                d[dx] = src_x[dx] == OUTSIDE ? black : s[src_x[dx]];
+            }
+        }
+    }
+}
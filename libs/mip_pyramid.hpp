@@ -0,0 +1,96 @@
+#pragma once
+
+#include "image.hpp"
+
+
+/*  mip pyramid
+
+    level 0 is a view of an image owned by the caller
+    each following level is half the size of the previous one
+    levels are divided into square tiles and only stale tiles are regenerated
+*/
+
+namespace mip
+{
+    constexpr u32 MAX_LEVELS = 12;
+
+
+    class TileGrid
+    {
+    public:
+        u32 width = 0;
+        u32 height = 0;
+
+        u8* stale = nullptr;
+    };
+
+
+    class Pyramid
+    {
+    public:
+        u32 tile_size = 0;
+        u32 n_levels = 0;
+
+        image::ImageView levels[MAX_LEVELS];
+        image::Image images[MAX_LEVELS];
+
+        TileGrid tiles[MAX_LEVELS];
+
+        // render_view column lookup, reallocated when the view width changes
+        u32* src_x = nullptr;
+        u32 src_x_width = 0;
+    };
+
+
+    bool create(Pyramid& pyramid, image::ImageView const& base, u32 tile_size);
+
+    void destroy(Pyramid& pyramid);
+}
+
+
+namespace mip
+{
+    Rect2Du32 level_rect(Pyramid const& pyramid, u32 level, Rect2Du32 const& base_rect);
+
+    Rect2Du32 tile_range(Pyramid const& pyramid, u32 level, Rect2Du32 const& level_rect);
+
+    Rect2Du32 tile_rect(Pyramid const& pyramid, u32 level, u32 tile_x, u32 tile_y);
+
+    image::SubView tile_view(Pyramid const& pyramid, u32 level, u32 tile_x, u32 tile_y);
+
+
+    // func(tile_x, tile_y) for each tile of level under the region base_rect of level 0
+    template <class F>
+    inline void for_each_tile(Pyramid const& pyramid, u32 level, Rect2Du32 const& base_rect, F const& func)
+    {
+        auto range = tile_range(pyramid, level, level_rect(pyramid, level, base_rect));
+
+        for (u32 y = range.y_begin; y < range.y_end; y++)
+        {
+            for (u32 x = range.x_begin; x < range.x_end; x++)
+            {
+                func(x, y);
+            }
+        }
+    }
+}
+
+
+namespace mip
+{
+    void invalidate(Pyramid& pyramid, Rect2Du32 const& base_rect);
+
+    void invalidate(Pyramid& pyramid);
+
+    void update_tile(Pyramid& pyramid, u32 level, u32 tile_x, u32 tile_y);
+
+    void update(Pyramid& pyramid);
+}
+
+
+namespace mip
+{
+    u32 view_level(Pyramid const& pyramid, f32 zoom);
+
+    void render_view(Pyramid& pyramid, f32 x, f32 y, f32 zoom, image::SubView const& dst);
+}
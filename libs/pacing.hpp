@@ -0,0 +1,143 @@
+#pragma once
+
+#include "stopwatch.hpp"
+
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+
+/*  frame pacing
+
+    frames are scheduled on an absolute deadline that advances by one frame period
+    the wait sleeps until close to the deadline and yields for the rest
+    a frame later than a full period starts a new schedule instead of catching up
+*/
+
+namespace pacing
+{
+    using Clock = timing::Clock;
+
+    // sleeping is only accurate to the system timer resolution
+    constexpr i64 SPIN_MARGIN_NS = 2'000'000;
+
+
+    class FramePacer
+    {
+    public:
+        i64 frame_ns = 0;
+
+        Clock::time_point deadline;
+        Clock::time_point last_frame;
+
+        // only frames on the schedule are recorded
+        bool on_schedule = false;
+
+        // every frame marked, the histogram has one interval less
+        u64 n_frames = 0;
+
+        // frame times in ns
+        timing::Histogram histogram;
+    };
+}
+
+
+namespace pacing
+{
+    inline void print_stats(timing::Histogram const& hist, FILE* out)
+    {
+        constexpr f64 ms = 1'000'000.0;
+
+        auto n_frames = timing::count(hist);
+        if (!n_frames)
+        {
+            fprintf(out, "frames: 0\n");
+            return;
+        }
+
+        fprintf(out, "frames: %llu mean: %.3f ms min: %.3f ms p50: %.3f ms p99: %.3f ms max: %.3f ms\n",
+            (unsigned long long)n_frames,
+            timing::mean(hist) / ms,
+            timing::min_value(hist) / ms,
+            timing::percentile(hist, 0.5) / ms,
+            timing::percentile(hist, 0.99) / ms,
+            timing::max_value(hist) / ms);
+    }
+}
+
+
+namespace pacing
+{
+    inline void start(FramePacer& pacer, f64 target_ns)
+    {
+        pacer.frame_ns = (i64)target_ns;
+        pacer.last_frame = Clock::now();
+        pacer.deadline = pacer.last_frame;
+        pacer.on_schedule = false;
+        pacer.n_frames = 0;
+        timing::reset(pacer.histogram);
+    }
+
+
+    // records the frame without waiting, for running as fast as possible
+    inline void mark_frame(FramePacer& pacer)
+    {
+        auto now = Clock::now();
+
+        pacer.n_frames++;
+
+        if (pacer.on_schedule)
+        {
+            timing::record(pacer.histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(now - pacer.last_frame).count());
+        }
+
+        pacer.last_frame = now;
+        pacer.on_schedule = true;
+    }
+
+
+    // call after presenting a frame, returns when the next frame may start
+    inline void wait_for_next_frame(FramePacer& pacer)
+    {
+        auto const frame = std::chrono::nanoseconds(pacer.frame_ns);
+        auto const margin = std::chrono::nanoseconds(SPIN_MARGIN_NS);
+
+        auto now = Clock::now();
+
+        if (now < pacer.deadline)
+        {
+            if (pacer.deadline - now > margin)
+            {
+                std::this_thread::sleep_until(pacer.deadline - margin);
+            }
+
+            while ((now = Clock::now()) < pacer.deadline)
+            {
+                std::this_thread::yield();
+            }
+
+            pacer.deadline += frame;
+        }
+        else if (now - pacer.deadline < frame)
+        {
+            // a little late, the next deadline absorbs it
+            pacer.deadline += frame;
+        }
+        else
+        {
+            // first frame after being idle
+            pacer.deadline = now + frame;
+            pacer.on_schedule = false;
+        }
+
+        pacer.n_frames++;
+
+        if (pacer.on_schedule)
+        {
+            timing::record(pacer.histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(now - pacer.last_frame).count());
+        }
+
+        pacer.last_frame = now;
+        pacer.on_schedule = true;
+    }
+}
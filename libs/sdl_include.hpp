@@ -1,6 +1,9 @@
 #pragma once
 
 #include "image.hpp"
+#include "trace.hpp"
+
+#include <cassert>
 
 
 #if defined(_WIN32)
@@ -89,37 +92,45 @@ namespace sdl
     }
 
 
-    static void display_error(const char* msg)
-    {
-#ifndef NO_WINDOW
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "ERROR", msg, 0);
-#endif
-
-        print_error(msg);
-    }
+    // no visible window and software rendering, for machines without a display
+    static bool is_headless = false;
 
 
-    static void handle_window_event(SDL_WindowEvent const& w_event)
+    static bool init_headless()
     {
-#ifndef NO_WINDOW
+        is_headless = true;
 
-        auto window = SDL_GetWindowFromID(w_event.windowID);
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
 
-        switch(w_event.event)
-        {
-            case SDL_WINDOWEVENT_SIZE_CHANGED:
-            {
+        // offscreen is not available in every SDL build, dummy always is
+        cstr drivers[] = { "offscreen", "dummy" };
 
-            }break;
-            case SDL_WINDOWEVENT_EXPOSED:
+        for (auto driver : drivers)
+        {
+            SDL_SetHint(SDL_HINT_VIDEODRIVER, driver);
+            if (SDL_Init(SDL_INIT_VIDEO) == 0)
             {
-                
-            } break;
+                return true;
+            }
         }
 
+        print_error("SDL_Init failed");
+        return false;
+    }
+
+
+    static void display_error(const char* msg)
+    {
+#ifndef NO_WINDOW
+        if (!is_headless)
+        {
+            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "ERROR", msg, 0);
+        }
 #endif
+
+        print_error(msg);
     }
-    
+
 
     template <typename T>
     static void set_window_icon(SDL_Window* window, T const& icon_64)
@@ -154,6 +165,25 @@ namespace sdl
     }
 
 
+    static u32 register_user_event()
+    {
+        return SDL_RegisterEvents(1);
+    }
+
+
+    // safe to call from any thread, wakes up SDL_WaitEvent
+    static void push_user_event(u32 type)
+    {
+        SDL_Event event{};
+        event.type = type;
+
+        if (SDL_PushEvent(&event) < 0)
+        {
+            print_error("SDL_PushEvent failed");
+        }
+    }
+
+
     static void toggle_fullscreen(SDL_Window* window)
     {
         static bool is_fullscreen = false;
@@ -184,27 +214,98 @@ namespace sdl
         SDL_Renderer* renderer = nullptr;
         SDL_Texture* texture = nullptr;
 
-        image::Image image;
-        image::ImageView view;
+        u32 texture_width = 0;
+        u32 texture_height = 0;
 
         u32 window_width = 0;
         u32 window_height = 0;
+
+        // texture was written or the window needs to be presented again
+        bool redraw = false;
     };
 
 
-    static void destroy_screen_memory(ScreenMemory& screen)
+    // texture pixels are written in place and are write-only
+    // every pixel of the locked range must be written before unlock_screen
+    static bool lock_screen(ScreenMemory& screen, Rect2Du32 const& range, image::SubView& view)
+    {
+        assert(range.x_end <= screen.texture_width);
+        assert(range.y_end <= screen.texture_height);
+
+        SDL_Rect rect{};
+        rect.x = (int)range.x_begin;
+        rect.y = (int)range.y_begin;
+        rect.w = (int)(range.x_end - range.x_begin);
+        rect.h = (int)(range.y_end - range.y_begin);
+
+        void* pixels = nullptr;
+        int pitch = 0;
+
+        if (SDL_LockTexture(screen.texture, &rect, &pixels, &pitch))
+        {
+            print_error("SDL_LockTexture failed");
+            return false;
+        }
+
+        view.matrix_data_ = (image::Pixel*)pixels;
+        view.matrix_width = (u32)pitch / SCREEN_BYTES_PER_PIXEL;
+        view.x_begin = 0;
+        view.y_begin = 0;
+        view.width = (u32)rect.w;
+        view.height = (u32)rect.h;
+
+        return true;
+    }
+
+
+    static void unlock_screen(ScreenMemory& screen)
+    {
+        SDL_UnlockTexture(screen.texture);
+
+        screen.redraw = true;
+    }
+
+
+    // returns true when the window contents need to be presented again
+    // the new window size is recorded in screen.window_width/window_height
+    static bool handle_window_event(ScreenMemory& screen, SDL_WindowEvent const& w_event)
     {
-        if (screen.image.data_)
+#ifndef NO_WINDOW
+
+        switch(w_event.event)
         {
-            image::destroy_image(screen.image);
+            case SDL_WINDOWEVENT_SIZE_CHANGED:
+            {
+                screen.window_width = (u32)w_event.data1;
+                screen.window_height = (u32)w_event.data2;
+                return true;
+            }break;
+            case SDL_WINDOWEVENT_EXPOSED:
+            case SDL_WINDOWEVENT_SHOWN:
+            case SDL_WINDOWEVENT_RESTORED:
+            case SDL_WINDOWEVENT_MAXIMIZED:
+            {
+                return true;
+            } break;
         }
 
+#endif
+
+        return false;
+    }
+    
+
+    static void destroy_screen_memory(ScreenMemory& screen)
+    {
         if (screen.texture)
         {
             SDL_DestroyTexture(screen.texture);
             screen.texture = nullptr;
         }
 
+        screen.texture_width = 0;
+        screen.texture_height = 0;
+
         if (screen.renderer)
         {
             SDL_DestroyRenderer(screen.renderer);
@@ -232,7 +333,7 @@ namespace sdl
                 SDL_WINDOWPOS_UNDEFINED,
                 (int)width,
                 (int)height,
-                SDL_WINDOW_RESIZABLE);
+                is_headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE);
 
             if(!screen.window)
             {
@@ -249,7 +350,9 @@ namespace sdl
 
         static bool create_renderer(ScreenMemory& screen)
         {
-            screen.renderer = SDL_CreateRenderer(screen.window, -1, 0);
+            Uint32 flags = is_headless ? SDL_RENDERER_SOFTWARE : 0;
+
+            screen.renderer = SDL_CreateRenderer(screen.window, -1, flags);
 
             if(!screen.renderer)
             {
@@ -276,25 +379,13 @@ namespace sdl
                 return false;
             }
 
-            return true;
-        }
-
-
-        static bool create_image(ScreenMemory& screen, u32 width, u32 height)
-        {
-            if(!image::create_image(screen.image, width, height))
-            {
-                display_error("Allocating image memory failed");
-                return false;
-            }
-
-            screen.image.width = width;
-            screen.image.height = height;
-
-            screen.view = image::make_view(screen.image);
+            screen.texture_width = width;
+            screen.texture_height = height;
+            screen.redraw = true;
 
             return true;
         }
+
     }
 
 
@@ -320,12 +411,6 @@ namespace sdl
             return false;
         }
 
-        if (!screen::create_image(screen, width, height))
-        {
-            destroy_screen_memory(screen);
-            return false;
-        }
-
         return true;
     }
 
@@ -352,35 +437,22 @@ namespace sdl
             return false;
         }
 
-        if (!screen::create_image(screen, screen_dim.x, screen_dim.y))
-        {
-            destroy_screen_memory(screen);
-            return false;
-        }
-
         return true;
     }
 
 
     static bool resize_screen_texture(ScreenMemory& screen, Vec2Du32 screen_dim)
     {
-        if (screen.image.data_)
-        {
-            image::destroy_image(screen.image);
-        }
-        
         if (screen.texture)
         {
             SDL_DestroyTexture(screen.texture);
             screen.texture = nullptr;
         }
 
-        if (!screen::create_texture(screen, screen_dim.x, screen_dim.y))
-        {
-            return false;
-        }
+        screen.texture_width = 0;
+        screen.texture_height = 0;
 
-        if (!screen::create_image(screen, screen_dim.x, screen_dim.y))
+        if (!screen::create_texture(screen, screen_dim.x, screen_dim.y))
         {
             return false;
         }
@@ -389,29 +461,32 @@ namespace sdl
     }
 
 
-    static void render_screen(ScreenMemory const& screen)
+    // returns true if the screen was presented
+    static bool render_screen(ScreenMemory& screen)
     {
-        auto const pitch = screen.image.width * SCREEN_BYTES_PER_PIXEL;        
-
-        #ifdef PRINT_MESSAGES
-
-        auto error = SDL_UpdateTexture(screen.texture, 0, (void*)screen.image.data_, pitch);
-        if(error)
+        if (!screen.redraw)
         {
-            print_error("SDL_UpdateTexture failed");
+            return false;
         }
 
-        error = SDL_RenderCopy(screen.renderer, screen.texture, 0, 0);
+        TRACE_SCOPE("present");
+
+        #ifdef PRINT_MESSAGES
+
+        auto error = SDL_RenderCopy(screen.renderer, screen.texture, 0, 0);
         if(error)
         {
             print_error("SDL_RenderCopy failed");
         }
 
         #else
-        SDL_UpdateTexture(screen.texture, 0, (void*)screen.image.data_, pitch);
         SDL_RenderCopy(screen.renderer, screen.texture, 0, 0);
         #endif
         
         SDL_RenderPresent(screen.renderer);
+
+        screen.redraw = false;
+
+        return true;
     }
-}
+}
\ No newline at end of file
@@ -1,5 +1,10 @@
 #pragma once
+
+#include "types.hpp"
+
 #include <chrono>
+#include <atomic>
+#include <algorithm>
 
 class Stopwatch
 {
@@ -54,4 +59,227 @@ public:
 		return delay.count();
 	}
 
-};
\ No newline at end of file
+};
+
+
+/*  latency histogram
+
+	log-linear buckets: values below 2 * SUB_BUCKETS have their own bucket,
+	each following power of two is split into SUB_BUCKETS buckets (about 3% wide)
+	recording is lock-free, any thread can record while another reads
+	values are nanoseconds but any non-negative integer works
+*/
+
+namespace timing
+{
+	using Clock = std::chrono::steady_clock;
+
+	constexpr u32 SUB_BUCKET_BITS = 5;
+	constexpr u32 SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+
+	// values from 2^MAX_VALUE_BITS ns (about 73 minutes) go in the last bucket
+	constexpr u32 MAX_VALUE_BITS = 42;
+	constexpr u32 HISTOGRAM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+
+	class Histogram
+	{
+	public:
+		std::atomic<u64> counts[HISTOGRAM_BUCKETS] = {};
+
+		std::atomic<u64> n_values = 0;
+		std::atomic<i64> total = 0;
+		std::atomic<i64> min = INT64_MAX;
+		std::atomic<i64> max = 0;
+	};
+
+
+	inline i64 now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+
+	inline u32 bucket_index(i64 value)
+	{
+		if (value < (i64)(2 * SUB_BUCKETS))
+		{
+			return value < 0 ? 0 : (u32)value;
+		}
+
+		u32 msb = 63;
+		while (!((u64)value >> msb))
+		{
+			msb--;
+		}
+
+		auto shift = msb - SUB_BUCKET_BITS;
+		auto index = shift * SUB_BUCKETS + (u32)((u64)value >> shift);
+
+		return std::min(index, HISTOGRAM_BUCKETS - 1);
+	}
+
+
+	// largest value that lands in the bucket
+	inline i64 bucket_upper(u32 index)
+	{
+		if (index < 2 * SUB_BUCKETS)
+		{
+			return index;
+		}
+
+		auto shift = index / SUB_BUCKETS - 1;
+		auto sub = (u64)(index - shift * SUB_BUCKETS);
+
+		return (i64)(((sub + 1) << shift) - 1);
+	}
+
+
+	inline void record(Histogram& hist, i64 value)
+	{
+		if (value < 0)
+		{
+			value = 0;
+		}
+
+		constexpr auto order = std::memory_order_relaxed;
+
+		hist.counts[bucket_index(value)].fetch_add(1, order);
+		hist.total.fetch_add(value, order);
+
+		auto min = hist.min.load(order);
+		while (value < min && !hist.min.compare_exchange_weak(min, value, order))
+		{ }
+
+		auto max = hist.max.load(order);
+		while (value > max && !hist.max.compare_exchange_weak(max, value, order))
+		{ }
+
+		// counted last so a reader never sees more values than buckets
+		hist.n_values.fetch_add(1, std::memory_order_release);
+	}
+
+
+	inline void reset(Histogram& hist)
+	{
+		for (auto& count : hist.counts)
+		{
+			count = 0;
+		}
+
+		hist.n_values = 0;
+		hist.total = 0;
+		hist.min = INT64_MAX;
+		hist.max = 0;
+	}
+
+
+	// adds src into dst e.g. per-thread histograms into one
+	inline void merge(Histogram& dst, Histogram const& src)
+	{
+		constexpr auto order = std::memory_order_relaxed;
+
+		for (u32 i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			auto count = src.counts[i].load(order);
+			if (count)
+			{
+				dst.counts[i].fetch_add(count, order);
+			}
+		}
+
+		auto n = src.n_values.load(std::memory_order_acquire);
+		if (!n)
+		{
+			return;
+		}
+
+		dst.total.fetch_add(src.total.load(order), order);
+
+		auto src_min = src.min.load(order);
+		auto min = dst.min.load(order);
+		while (src_min < min && !dst.min.compare_exchange_weak(min, src_min, order))
+		{ }
+
+		auto src_max = src.max.load(order);
+		auto max = dst.max.load(order);
+		while (src_max > max && !dst.max.compare_exchange_weak(max, src_max, order))
+		{ }
+
+		dst.n_values.fetch_add(n, std::memory_order_release);
+	}
+
+
+	inline u64 count(Histogram const& hist)
+	{
+		return hist.n_values.load(std::memory_order_acquire);
+	}
+
+
+	inline f64 mean(Histogram const& hist)
+	{
+		auto n = count(hist);
+
+		return n ? (f64)hist.total.load(std::memory_order_relaxed) / n : 0.0;
+	}
+
+
+	inline i64 min_value(Histogram const& hist)
+	{
+		return count(hist) ? hist.min.load(std::memory_order_relaxed) : 0;
+	}
+
+
+	inline i64 max_value(Histogram const& hist)
+	{
+		return hist.max.load(std::memory_order_relaxed);
+	}
+
+
+	// within one bucket (about 3%) above the true value, p in [0, 1]
+	inline i64 percentile(Histogram const& hist, f64 p)
+	{
+		auto n = count(hist);
+		if (!n)
+		{
+			return 0;
+		}
+
+		auto target = (u64)(p * n + 0.5);
+		if (!target)
+		{
+			target = 1;
+		}
+
+		u64 total = 0;
+		for (u32 i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			total += hist.counts[i].load(std::memory_order_relaxed);
+			if (total >= target)
+			{
+				return std::min(bucket_upper(i), max_value(hist));
+			}
+		}
+
+		return max_value(hist);
+	}
+
+
+	// records the lifetime of the scope, see also TRACE_TIMED_SCOPE
+	class ScopedTimer
+	{
+	public:
+		Histogram& hist;
+		i64 begin_ns;
+
+		ScopedTimer(Histogram& h) : hist(h), begin_ns(now_ns()) {}
+
+		~ScopedTimer()
+		{
+			record(hist, now_ns() - begin_ns);
+		}
+
+		ScopedTimer(ScopedTimer const&) = delete;
+		ScopedTimer& operator = (ScopedTimer const&) = delete;
+	};
+}
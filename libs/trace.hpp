@@ -0,0 +1,343 @@
+#pragma once
+
+#include "types.hpp"
+#include "stopwatch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*  scoped trace points
+
+    each thread records into its own ring buffer, the oldest events are overwritten
+    events are written as Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev)
+    when tracing is disabled a trace point costs one relaxed atomic load
+    define NO_TRACE to compile trace points out
+    times come from timing::now_ns, TRACE_TIMED_SCOPE feeds a timing::Histogram from the same timestamps
+*/
+
+namespace trace
+{
+    constexpr u32 RING_SIZE = 1u << 14;
+
+    // threads that are not one per core, the registry adds one per core for worker pools
+    constexpr u32 MAX_FIXED_THREADS = 16;
+    constexpr u32 MAX_NAME_LENGTH = 32;
+
+
+    class Event
+    {
+    public:
+        cstr name = nullptr;
+
+        i64 begin_ns = 0;
+
+        // < 0 for an instant event
+        i64 duration_ns = 0;
+
+        i64 arg = 0;
+    };
+
+
+    class ThreadBuffer
+    {
+    public:
+        u32 id = 0;
+        char name[MAX_NAME_LENGTH] = { 0 };
+
+        Event events[RING_SIZE];
+
+        // events ever written, the ring index is count % RING_SIZE
+        std::atomic<u64> count = 0;
+    };
+
+
+    class Registry
+    {
+    public:
+        std::atomic<bool> enabled = false;
+
+        // timing::now_ns at startup, events start from 0
+        i64 epoch_ns = timing::now_ns();
+
+        u32 max_threads = MAX_FIXED_THREADS + std::thread::hardware_concurrency();
+
+        std::mutex mutex;
+        std::vector<ThreadBuffer*> buffers;
+
+        // threads that got no buffer, their events are lost
+        std::atomic<u32> n_dropped = 0;
+    };
+
+
+    inline Registry registry;
+
+    inline thread_local ThreadBuffer* thread_buffer = nullptr;
+    inline thread_local bool thread_dropped = false;
+}
+
+
+namespace trace
+{
+    inline bool is_enabled()
+    {
+        return registry.enabled.load(std::memory_order_relaxed);
+    }
+
+
+    inline void enable(bool on)
+    {
+        registry.enabled.store(on, std::memory_order_relaxed);
+    }
+
+
+    inline i64 now_ns()
+    {
+        return timing::now_ns() - registry.epoch_ns;
+    }
+
+
+    // nullptr when max_threads threads are already registered, the thread is counted as dropped once
+    inline ThreadBuffer* get_thread_buffer()
+    {
+        if (thread_buffer || thread_dropped)
+        {
+            return thread_buffer;
+        }
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        if (registry.buffers.size() >= registry.max_threads)
+        {
+            thread_dropped = true;
+            registry.n_dropped++;
+            return nullptr;
+        }
+
+        auto buffer = new ThreadBuffer();
+        buffer->id = (u32)registry.buffers.size() + 1;
+        snprintf(buffer->name, MAX_NAME_LENGTH, "thread %u", buffer->id);
+
+        registry.buffers.push_back(buffer);
+        thread_buffer = buffer;
+
+        return buffer;
+    }
+
+
+    // threads only get a buffer when tracing is enabled
+    inline void set_thread_name(cstr name)
+    {
+        if (!is_enabled())
+        {
+            return;
+        }
+
+        auto buffer = get_thread_buffer();
+        if (buffer)
+        {
+            snprintf(buffer->name, MAX_NAME_LENGTH, "%s", name);
+        }
+    }
+
+
+    inline u32 dropped_threads()
+    {
+        return registry.n_dropped.load(std::memory_order_relaxed);
+    }
+
+
+    // name must be a string literal or otherwise outlive the trace
+    inline void record(cstr name, i64 begin_ns, i64 duration_ns, i64 arg = 0)
+    {
+        auto buffer = get_thread_buffer();
+        if (!buffer)
+        {
+            return;
+        }
+
+        auto i = buffer->count.load(std::memory_order_relaxed);
+
+        auto& event = buffer->events[i % RING_SIZE];
+        event.name = name;
+        event.begin_ns = begin_ns;
+        event.duration_ns = duration_ns;
+        event.arg = arg;
+
+        buffer->count.store(i + 1, std::memory_order_release);
+    }
+
+
+    inline void instant(cstr name, i64 arg = 0)
+    {
+        if (is_enabled())
+        {
+            record(name, now_ns(), -1, arg);
+        }
+    }
+
+
+    // begin_ns and end_ns from timing::now_ns, e.g. the ones a histogram got
+    inline void record_span(cstr name, i64 begin_ns, i64 end_ns, i64 arg = 0)
+    {
+        if (is_enabled())
+        {
+            record(name, begin_ns - registry.epoch_ns, end_ns - begin_ns, arg);
+        }
+    }
+
+
+    class Scope
+    {
+    public:
+        cstr name = nullptr;
+        i64 arg = 0;
+
+        // timing::now_ns, -1 when there is nothing to record
+        i64 begin_ns = -1;
+
+        timing::Histogram* hist = nullptr;
+
+        Scope(cstr event_name, i64 event_arg = 0)
+        {
+            if (is_enabled())
+            {
+                name = event_name;
+                arg = event_arg;
+                begin_ns = timing::now_ns();
+            }
+        }
+
+        // the histogram gets the duration whether tracing is enabled or not
+        Scope(cstr event_name, timing::Histogram& event_hist)
+        {
+            name = is_enabled() ? event_name : nullptr;
+            hist = &event_hist;
+            begin_ns = timing::now_ns();
+        }
+
+        ~Scope()
+        {
+            if (begin_ns < 0)
+            {
+                return;
+            }
+
+            auto end_ns = timing::now_ns();
+
+            if (hist)
+            {
+                timing::record(*hist, end_ns - begin_ns);
+            }
+
+            if (name)
+            {
+                record(name, begin_ns - registry.epoch_ns, end_ns - begin_ns, arg);
+            }
+        }
+
+        Scope(Scope const&) = delete;
+        Scope& operator = (Scope const&) = delete;
+    };
+}
+
+
+namespace trace
+{
+    inline void write_event(FILE* out, u32 tid, Event const& e, bool& first)
+    {
+        constexpr f64 us = 1000.0;
+
+        fprintf(out, "%s\n", first ? "" : ",");
+        first = false;
+
+        if (e.duration_ns < 0)
+        {
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%lld}}",
+                e.name, e.begin_ns / us, tid, (long long)e.arg);
+        }
+        else
+        {
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%lld}}",
+                e.name, e.begin_ns / us, e.duration_ns / us, tid, (long long)e.arg);
+        }
+    }
+
+
+    // safe while other threads keep recording, events overwritten during the copy are skipped
+    inline bool write_chrome_json(cstr path)
+    {
+        auto out = fopen(path, "w");
+        if (!out)
+        {
+            return false;
+        }
+
+        auto events = new Event[RING_SIZE];
+
+        fprintf(out, "{\"traceEvents\":[");
+
+        bool first = true;
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        for (auto b : registry.buffers)
+        {
+            auto const& buffer = *b;
+
+            fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", buffer.id, buffer.name);
+            first = false;
+
+            auto end = buffer.count.load(std::memory_order_acquire);
+            auto begin = end > RING_SIZE ? end - RING_SIZE : 0;
+
+            for (auto i = begin; i < end; i++)
+            {
+                events[i - begin] = buffer.events[i % RING_SIZE];
+            }
+
+            // the writer may have lapped the oldest events while copying
+            // and may be writing event #valid, which overwrites #(valid - RING_SIZE)
+            auto valid = buffer.count.load(std::memory_order_acquire);
+            auto valid_begin = valid >= RING_SIZE ? valid - RING_SIZE + 1 : 0;
+
+            for (auto i = std::max(begin, valid_begin); i < end; i++)
+            {
+                write_event(out, buffer.id, events[i - begin], first);
+            }
+        }
+
+        fprintf(out, "\n],\"otherData\":{\"dropped_threads\":%u},\"displayTimeUnit\":\"ms\"}\n", dropped_threads());
+
+        delete[] events;
+
+        fclose(out);
+
+        return true;
+    }
+}
+
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef NO_TRACE
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#define TRACE_INSTANT(name, arg)
+#define TRACE_TIMED_SCOPE(name, hist) timing::ScopedTimer TRACE_CONCAT(trace_timer_, __LINE__)(hist)
+
+#else
+
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, (i64)(arg))
+#define TRACE_INSTANT(name, arg) trace::instant(name, (i64)(arg))
+#define TRACE_TIMED_SCOPE(name, hist) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, hist)
+
+#endif
@@ -1,15 +1,47 @@
 #include "../libs/sdl_include.hpp"
-#include "../libs/stopwatch.hpp"
+#include "../libs/pacing.hpp"
+#include "../libs/trace.hpp"
+#include "../libs/metrics.hpp"
+#include "../libs/hash.hpp"
+#include "../libs/mip_pyramid.hpp"
 
 #include <filesystem>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <algorithm>
+#include <vector>
 #include <unordered_map>
 #include <cassert>
+#include <cmath>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+
+#define NOMINMAX
 #include <windows.h>
 
+#else
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+#endif
+
 namespace fs = std::filesystem;
 namespace img = image;
 
@@ -22,19 +54,93 @@ constexpr u32 MAP_HEIGHT = 8;
 constexpr u32 GAME_SCREEN_WIDTH = 256;
 constexpr u32 GAME_SCREEN_HEIGHT = 168;
 
+// full frame with the HUD above the play field
+constexpr u32 NES_FRAME_WIDTH = 256;
+constexpr u32 NES_FRAME_HEIGHT = 240;
+constexpr u32 HUD_MIN_HEIGHT = 48;
+
 constexpr f32 SCREEN_SCALE = 0.4f;
 
+constexpr u32 TILE_SIZE = 256;
+
+// screen images kept for recently used window sizes
+constexpr u32 SCREEN_CACHE_SIZE = 3;
+constexpr u32 SCREEN_BAND_HEIGHT = 64;
+
+constexpr f32 MAX_ZOOM = 8.0f;
+constexpr f32 ZOOM_STEP = 1.25f;
+
 constexpr f64 NANO = 1'000'000'000;
 constexpr f64 TARGET_FRAMERATE_HZ = 60.0;
 constexpr f64 TARGET_NS_PER_FRAME = NANO / TARGET_FRAMERATE_HZ;
 
+// how often blocked threads check if the program is still running
+constexpr u32 WAIT_TIMEOUT_MS = 200;
+
+// a screenshot that can not be read is tried again after 25, 50, 100 ... ms
+constexpr u32 MAX_READ_ATTEMPTS = 8;
+constexpr u32 READ_RETRY_MS = 25;
+constexpr u32 READ_RETRY_MAX_MS = 1000;
+
+// directory change buffer, 64 KB is the most ReadDirectoryChangesW allows for network shares
+constexpr u32 WATCH_BUFFER_SIZE = 64 * 1024;
+
+// frame stream read ahead
+constexpr u32 STREAM_READ_SIZE = 64 * 1024;
+constexpr u32 MAX_PAM_HEADER_SIZE = 1024;
+
+// play fields kept per screen, the map shows the most common color of each pixel
+constexpr u32 MAX_SCREEN_SAMPLES = 5;
+constexpr u32 MAX_PALETTE_COLORS = 256;
+
+// frame validation, see is_valid_frame
+constexpr u32 DARK_LUMA = 32;
+constexpr u32 MAX_DARK_PERCENT = 97;
+constexpr u32 MIN_PLAY_FIELD_COLORS = 2;
+constexpr u32 MIN_HUD_GRAY_PERCENT = 90;
+constexpr u32 MIN_FADE_LUMA_PERCENT = 60;
+
+// input normalization, see find_frame_scale
+constexpr u32 MAX_FRAME_SCALE = 8;
+constexpr u32 MAX_OVERSCAN_CROP = 16;
+constexpr u32 HUD_GRAY_TOLERANCE = 24;
+
+// frames remembered by the stream, a screen must be the same for K of them to be committed
+constexpr u32 STREAM_HISTORY = 8;
+constexpr u32 DEFAULT_STABLE_FRAMES = 3;
+
+// offline video, the top left of a frame that covers the mini-map
+constexpr u32 VIDEO_LOCATE_WIDTH = 80;
+constexpr u32 VIDEO_LOCATE_HEIGHT = 48;
+
+// frames are split into segments of at least this many frames, one per thread
+constexpr u64 VIDEO_MIN_SEGMENT_FRAMES = 600;
+
+#ifndef _WIN32
+// IN_CREATE is only used for directories, a new file is read once it is closed
+constexpr u32 WATCH_EVENTS = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+#endif
+
 constexpr auto DEFAULT_WATCH_DIR = "./";
 constexpr auto DEFAULT_MAP_SAVE_DIR = "./";
-constexpr auto MAP_FILE_NAME = "zelda_map.png";
+constexpr auto MAP_FILE_STEM = "zelda_map";
+constexpr auto DEFAULT_MAP_FORMAT = "png";
+constexpr auto DEFAULT_SCREENSHOT_FORMAT = "any";
+constexpr auto SCREEN_EXPORT_DIR_NAME = "zelda_map_screens";
+constexpr auto SCREEN_EXPORT_MANIFEST_NAME = "manifest.txt";
+constexpr auto TILE_MANIFEST_NAME = "manifest.txt";
+constexpr auto STATS_FILE_NAME = "zelda_map_stats.jsonl";
+constexpr auto TRACE_FILE_NAME = "zelda_map_trace.json";
 
 constexpr auto SETTINGS_FILE_EXT = ".ini";
 constexpr auto SETTINGS_WATCH_DIR_KEY = "SCREENSHOT_DIRECTORY";
 constexpr auto SETTINGS_MAP_SAVE_DIR_KEY = "SAVE_DIRECTORY";
+constexpr auto SETTINGS_TILE_DIR_KEY = "TILE_DIRECTORY";
+constexpr auto SETTINGS_MAP_FORMAT_KEY = "MAP_FORMAT";
+constexpr auto SETTINGS_SCREENSHOT_FORMAT_KEY = "SCREENSHOT_FORMAT";
+constexpr auto SETTINGS_STATS_INTERVAL_KEY = "STATS_INTERVAL";
+
+constexpr std::array<cstr, 3> IMAGE_FORMATS = { "png", "bmp", "qoi" };
 
 
 class Image
@@ -62,20 +168,135 @@ public:
 class AppSettings
 {
 public:
-    fs::path watch_dir;
+    // screenshot directories, watched with their subdirectories
+    std::vector<fs::path> watch_dirs;
+
     fs::path map_save_path;
+
+    // extension of the screenshots to watch for e.g. ".png", empty for any image format
+    Str screenshot_ext;
+
+    // empty when tile export is disabled
+    fs::path tile_dir;
+
+    // seconds between stats lines, 0 to only write them on F and on close
+    u32 stats_interval_sec = 0;
+};
+
+
+// command line, headless runs are for automated timing
+class RunOptions
+{
+public:
+    bool headless = false;
+
+    // stop after this many presented frames, 0 for no limit
+    u32 max_frames = 0;
+
+    // stop once this many screenshots are on screen, 0 for no limit
+    u32 max_files = 0;
+
+    // record trace points, written on T and on close
+    bool trace = false;
+
+    // overrides the stats interval setting, stats go to stdout when headless
+    u32 stats_interval_sec = 0;
+
+    // raw RGBA or PAM frames from a FIFO, named pipe or file, "-" for stdin
+    Str stream_path;
+
+    // raw RGB or Y4M recording, read as fast as possible
+    Str video_path;
+
+    // size of raw frames, RGBA when streamed and RGB in a video, PAM and Y4M frames have their own
+    Vec2Du32 stream_dim = { NES_FRAME_WIDTH, NES_FRAME_HEIGHT };
+
+    // frames in a row with the same play field and position before a frame is committed
+    u32 stable_frames = DEFAULT_STABLE_FRAMES;
 };
 
 
+static RunOptions parse_run_options(int argc, char* argv[])
+{
+    RunOptions options{};
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = Str(argv[i]);
+        auto has_value = i + 1 < argc;
+
+        if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--frames" && has_value)
+        {
+            options.max_frames = (u32)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--files" && has_value)
+        {
+            options.max_files = (u32)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--trace")
+        {
+            options.trace = true;
+        }
+        else if (arg == "--stats" && has_value)
+        {
+            options.stats_interval_sec = (u32)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--stream" && has_value)
+        {
+            options.stream_path = argv[++i];
+        }
+        else if (arg == "--video" && has_value)
+        {
+            options.video_path = argv[++i];
+        }
+        else if (arg == "--stream-size" && has_value)
+        {
+            // WxH
+            char* end = nullptr;
+            auto width = (u32)std::strtoul(argv[++i], &end, 10);
+            auto height = end && *end == 'x' ? (u32)std::strtoul(end + 1, nullptr, 10) : 0;
+            if (width && height)
+            {
+                options.stream_dim = { width, height };
+            }
+        }
+        else if (arg == "--stable-frames" && has_value)
+        {
+            auto n = (u32)std::strtoul(argv[++i], nullptr, 10);
+            options.stable_frames = std::clamp(n, 2u, STREAM_HISTORY);
+        }
+    }
+
+    return options;
+}
+
+
 static void create_app_settings_file()
 {
     std::ostringstream oss;
 
-    oss << "# Directory where screenshots are stored\n";
+    oss << "# Directory where screenshots are stored, subdirectories included\n";
+    oss << "# Repeat the line to watch more than one directory\n";
     oss << SETTINGS_WATCH_DIR_KEY << " = " << DEFAULT_WATCH_DIR << "\n\n";
 
     oss << "# Directory where to save the generated map\n";
-    oss << SETTINGS_MAP_SAVE_DIR_KEY << " = " << DEFAULT_MAP_SAVE_DIR;
+    oss << SETTINGS_MAP_SAVE_DIR_KEY << " = " << DEFAULT_MAP_SAVE_DIR << "\n\n";
+
+    oss << "# Image format of the screenshots: png, bmp, qoi, pam or any\n";
+    oss << SETTINGS_SCREENSHOT_FORMAT_KEY << " = " << DEFAULT_SCREENSHOT_FORMAT << "\n\n";
+
+    oss << "# Image format of the saved map: png, bmp or qoi (qoi saves fastest)\n";
+    oss << SETTINGS_MAP_FORMAT_KEY << " = " << DEFAULT_MAP_FORMAT << "\n\n";
+
+    oss << "# Directory where to export zoomable map tiles (disabled when not set)\n";
+    oss << "# " << SETTINGS_TILE_DIR_KEY << " = ./tiles\n\n";
+
+    oss << "# Seconds between lines appended to the stats file (disabled when not set)\n";
+    oss << "# " << SETTINGS_STATS_INTERVAL_KEY << " = 60";
 
     std::ofstream ini("./settings.ini");
     ini << oss.str();
@@ -83,12 +304,87 @@ static void create_app_settings_file()
 }
 
 
+static Str to_lower(Str const& str)
+{
+    Str lower;
+    for (auto c : str)
+    {
+        lower += (char)std::tolower((unsigned char)c);
+    }
+
+    return lower;
+}
+
+
+static Str to_image_extension(Str const& format)
+{
+    auto ext = "." + to_lower(format);
+
+    for (auto f : IMAGE_FORMATS)
+    {
+        if (ext.compare(1, Str::npos, f) == 0)
+        {
+            return ext;
+        }
+    }
+
+    return "";
+}
+
+
+// ext is empty for any format, false for a format that cannot be read
+static bool to_screenshot_extension(Str const& format, Str& ext)
+{
+    auto e = "." + to_lower(format);
+    if (e == ".any")
+    {
+        ext = "";
+        return true;
+    }
+
+    if (img::format_from_extension(e.c_str()) == img::ImageFormat::Unknown)
+    {
+        return false;
+    }
+
+    ext = e;
+    return true;
+}
+
+
+static void report_bad_setting(Str const& key, Str const& value, cstr default_value)
+{
+    fprintf(stderr, "settings.ini: unknown %s \"%s\", using %s\n", key.c_str(), value.c_str(), default_value);
+}
+
+
+static bool is_screenshot_file(fs::path const& path, Str const& screenshot_ext)
+{
+    auto ext = to_lower(path.extension().string());
+    if (screenshot_ext.empty())
+    {
+        return img::format_from_extension(ext.c_str()) != img::ImageFormat::Unknown;
+    }
+
+    return ext == screenshot_ext;
+}
+
+
+static fs::path map_file_path(fs::path const& dir, Str const& ext)
+{
+    return dir / (Str(MAP_FILE_STEM) + ext);
+}
+
+
 AppSettings load_app_settings()
 {
     AppSettings s{};
 
-    s.watch_dir = fs::path(DEFAULT_WATCH_DIR);
-    s.map_save_path = fs::path(DEFAULT_MAP_SAVE_DIR) / MAP_FILE_NAME;
+    auto map_save_dir = fs::path(DEFAULT_MAP_SAVE_DIR);
+    auto map_ext = to_image_extension(DEFAULT_MAP_FORMAT);
+
+    to_screenshot_extension(DEFAULT_SCREENSHOT_FORMAT, s.screenshot_ext);
+    s.map_save_path = map_file_path(map_save_dir, map_ext);
 
     fs::path ini;
     bool found = false;
@@ -118,8 +414,13 @@ AppSettings load_app_settings()
 
     auto trim = [](Str const& str)
     {
-        auto first = str.find_first_not_of(" \t");
-        auto last = str.find_last_not_of(" \t");
+        auto first = str.find_first_not_of(" \t\r");
+        if (first == Str::npos)
+        {
+            return Str();
+        }
+
+        auto last = str.find_last_not_of(" \t\r");
         return str.substr(first, (last - first + 1));
     };
 
@@ -137,25 +438,77 @@ AppSettings load_app_settings()
             continue;
         }
 
-        auto dir = fs::path(trim(line.substr(pos + 1)));
+        auto key = trim(line.substr(0, pos));
+        auto value = trim(line.substr(pos + 1));
+
+        if (key == SETTINGS_MAP_FORMAT_KEY)
+        {
+            auto ext = to_image_extension(value);
+            if (!ext.empty())
+            {
+                map_ext = ext;
+            }
+            else
+            {
+                report_bad_setting(key, value, DEFAULT_MAP_FORMAT);
+            }
+
+            continue;
+        }
+
+        if (key == SETTINGS_SCREENSHOT_FORMAT_KEY)
+        {
+            if (!to_screenshot_extension(value, s.screenshot_ext))
+            {
+                report_bad_setting(key, value, DEFAULT_SCREENSHOT_FORMAT);
+            }
+
+            continue;
+        }
+
+        if (key == SETTINGS_STATS_INTERVAL_KEY)
+        {
+            s.stats_interval_sec = (u32)std::strtoul(value.c_str(), nullptr, 10);
+            continue;
+        }
+
+        auto dir = fs::path(value);
+
+        if (key == SETTINGS_TILE_DIR_KEY && !fs::exists(dir))
+        {
+            // created for the export, the other directories must exist
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+        }
+
         if (!fs::is_directory(dir))
         {
             continue;
         }
 
-        auto key = trim(line.substr(0, pos));        
         if (key == SETTINGS_WATCH_DIR_KEY)
         {
-            s.watch_dir = dir;
+            s.watch_dirs.push_back(dir);
         }
         else if (key == SETTINGS_MAP_SAVE_DIR_KEY)
         {
-            s.map_save_path = dir / MAP_FILE_NAME;
-        }        
+            map_save_dir = dir;
+        }
+        else if (key == SETTINGS_TILE_DIR_KEY)
+        {
+            s.tile_dir = dir;
+        }
     }
 
     file.close();
 
+    if (s.watch_dirs.empty())
+    {
+        s.watch_dirs.push_back(fs::path(DEFAULT_WATCH_DIR));
+    }
+
+    s.map_save_path = map_file_path(map_save_dir, map_ext);
+
     return s;
 }
 
@@ -164,281 +517,4008 @@ enum class FileStatus : int
 {
     New = 0,
     Existing,
-    Deleted
+    Deleted,
+
+    // could not be read yet, tried again after a backoff
+    Retry,
+
+    // could not be read after MAX_READ_ATTEMPTS
+    Failed
 };
 
 
-using FileList = std::unordered_map<fs::path, FileStatus>;
+class FileEntry
+{
+public:
+    FileStatus status = FileStatus::New;
 
+    // write time of the version that was decoded, an unchanged file is not decoded again
+    // min() and not {}, the clock's epoch can be after current file times
+    fs::file_time_type decoded_time = fs::file_time_type::min();
 
-enum class RunState : int
+    // write time when the directory was last indexed, a rescan queues the file again if it is newer
+    fs::file_time_type indexed_time = fs::file_time_type::min();
+};
+
+
+using FileList = std::unordered_map<fs::path, FileEntry>;
+
+
+class ImageQueue
 {
-    Start = 0,
-    Running,
-    End
+public:
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // every screenshot in the watched directories
+    FileList files;
+
+    // complete screenshots reported by the watcher, waiting to be decoded
+    std::vector<fs::path> pending;
+
+    // decoded screenshots waiting for the processing thread
+    std::vector<img::Image> images;
+
+    // trace time each image was queued
+    std::vector<i64> queued_ns;
 };
 
 
-class AppState
+#ifdef _WIN32
+
+class WatchRoot
 {
 public:
-    AppSettings settings;
+    fs::path dir;
 
-    HANDLE h_watch_dir;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped = {0};
 
-    FileList image_list;
+    // FILE_NOTIFY_INFORMATION records are DWORD aligned
+    std::vector<DWORD> buffer;
+};
+
+#endif
 
-    Image map_image;
-    img::ImageView map_view;
-    
-    sdl::ScreenMemory screen;
 
-    RunState run_state;
+// all screenshot directories and their subdirectories, watched from one thread
+class DirectoryWatch
+{
+public:
+    // normalized, none inside another
+    std::vector<fs::path> roots;
+
+    // output directories of the program, not watched when inside a root
+    std::vector<fs::path> excluded;
+
+    // extension of the screenshots, empty for any image format
+    Str image_ext;
+
+#ifdef _WIN32
+    // one per root, at most MAXIMUM_WAIT_OBJECTS
+    std::vector<WatchRoot> handles;
+#else
+    int fd = -1;
+
+    // watch descriptor to directory, one for each directory in the trees
+    std::unordered_map<int, fs::path> dirs;
+#endif
 };
 
 
-static AppState state;
+// a recording of raw RGB or Y4M frames, memory mapped
+class VideoSource
+{
+public:
+    mem::MappedFile file;
 
+    bool is_y4m = false;
+    img::y4m::Header header;
 
-static bool is_running()
+    Vec2Du32 dim{};
+
+    // offset of the pixels of each frame
+    std::vector<u64> frame_offsets;
+
+    std::atomic<bool> ended = false;
+};
+
+
+// frames [frame_begin, frame_end) of a video, scanned by one thread
+class VideoSegment
 {
-    return state.run_state == RunState::Running;
-}
+public:
+    u64 frame_begin = 0;
+    u64 frame_end = 0;
 
+    img::Image mini_map;
 
-static void end_program()
+    // the last two frames decoded
+    img::Image frames[2];
+
+    // index of the last stable frame of each screen, 0 if the screen was not seen
+    // a stable frame follows one equal to it, so it is never frame 0
+    std::array<u64, MAP_WIDTH * MAP_HEIGHT> screen_frames{};
+};
+
+
+// a scaled or cropped frame, see find_frame_scale
+class FrameLayout
 {
-    state.run_state = RunState::End;
-}
+public:
+    u32 scale = 1;
+
+    // native size of the visible part of the frame
+    Vec2Du32 dim{};
+
+    // where the visible part goes in a native frame
+    Point2Du32 offset{};
+};
 
 
-static bool write_map(img::ImageView const& src, img::ImageView const& map)
+class StreamSample
 {
-    // mini-map at top of screen
-    Rect2Du32 rm{};
-    rm.x_begin = 16;
-    rm.x_end = rm.x_begin + 64;
-    rm.y_begin = 16;
-    rm.y_end = rm.y_begin + 32;
+public:
+    bool located = false;
+    Point2Du32 screen{};
 
-    auto vm = img::sub_view(src, rm);
+    // CRC32C of the play field rows
+    u32 hash = 0;
+};
 
-    u32 x = 0;
-    u32 y = 0;
-    bool found = false;
-    for (y = 0; y < vm.height && !found; y++)
-    {
-        auto row = img::row_begin(vm, y);
-        for (x = 0; x < vm.width && !found; x++)
-        {
-            // first pixel that is not gray
-            auto p = row[x];
-            found = p.red != p.green && p.red != p.blue && p.red > 0;
-        }
-    }
 
-    if (!found)
-    {
-        return false;
-    }
+// raw RGBA or PAM frames, read by the stream thread
+class FrameStream
+{
+public:
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
 
-    x = (x - 1) / 4;
-    y /= 4;
+    bool is_stdin = false;
 
-    auto r = img::make_rect(x * GAME_SCREEN_WIDTH, y * GAME_SCREEN_HEIGHT, GAME_SCREEN_WIDTH, GAME_SCREEN_HEIGHT);
+    bool is_pam = false;
+    img::pam::Header header;
+    bool has_header = false;
 
-    auto dst = img::sub_view(map, r);
+    Vec2Du32 dim{};
 
-    r = img::make_rect(0, src.height - GAME_SCREEN_HEIGHT, GAME_SCREEN_WIDTH, GAME_SCREEN_HEIGHT);
+    // read ahead
+    std::vector<u8> buffer;
+    u32 begin = 0;
+    u32 end = 0;
 
-    img::copy(img::sub_view(src, r), dst);
+    // pixels of a PAM frame as sent
+    std::vector<u8> pixel_bytes;
 
-    return true;
-}
+    img::Image frame;
+
+    // frames that are not native size are sampled down into native
+    bool is_scaled = false;
+    FrameLayout layout;
+    img::Image native;
+
+    // the last STREAM_HISTORY frames, frame n at n % STREAM_HISTORY
+    StreamSample history[STREAM_HISTORY];
+    u64 n_frames = 0;
+
+    // play field hash of the frame last committed for each screen
+    std::array<bool, MAP_WIDTH * MAP_HEIGHT> committed{};
+    std::array<u32, MAP_WIDTH * MAP_HEIGHT> committed_hash{};
+
+    std::atomic<bool> ended = false;
+};
 
 
-static bool update_map(AppSettings const& settings, FileList& image_list, img::ImageView const& map)
+enum class RunState : int
 {
-    bool update = false;
-    for (auto& [path, state] : image_list)
-    {
-        if (state != FileStatus::New)
-        {
-            continue;
-        }
+    Start = 0,
+    Running,
+    End
+};
 
-        state = FileStatus::Existing;
 
-        if (path.filename() == settings.map_save_path.filename())
-        {
-            continue;
-        }
+using ScreenFlags = std::array<bool, MAP_WIDTH * MAP_HEIGHT>;
 
-        auto full_path = settings.watch_dir / path;
 
-        Image image;
+static Rect2Du32 screen_rect(u32 screen_x, u32 screen_y)
+{
+    return img::make_rect(screen_x * GAME_SCREEN_WIDTH, screen_y * GAME_SCREEN_HEIGHT, GAME_SCREEN_WIDTH, GAME_SCREEN_HEIGHT);
+}
+
+
+/* tile export */
+
+class TileExporter
+{
+public:
+    fs::path tile_dir;
+
+    // copy of the map owned by the export thread
+    img::Image base;
+    mip::Pyramid pyramid;
+
+    // content hash of each screen the tiles on disk were made from, owned by the export thread
+    std::array<u64, MAP_WIDTH * MAP_HEIGHT> hashes{};
+
+    // screens changed since the tiles on disk were written
+    ScreenFlags changed{};
+
+    // screens copied from the map, waiting for the export thread
+    std::array<img::Image, MAP_WIDTH * MAP_HEIGHT> staged;
+    ScreenFlags pending{};
+    u32 n_pending = 0;
+
+    bool write_all = false;
+    bool stop = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
+
+
+static fs::path tile_path(fs::path const& tile_dir, u32 level, u32 tile_x, u32 tile_y)
+{
+    auto name = std::to_string(tile_x) + "_" + std::to_string(tile_y) + ".png";
+
+    return tile_dir / std::to_string(level) / name;
+}
+
+
+static void write_tile(TileExporter& ex, u32 level, u32 tile_x, u32 tile_y)
+{
+    auto tile = mip::tile_view(ex.pyramid, level, tile_x, tile_y);
+    auto path = tile_path(ex.tile_dir, level, tile_x, tile_y);
+
+    img::write_to_file(tile, path.generic_string().c_str());
+}
+
+
+// false when there is no manifest or the tiles have another size
+static bool load_tile_manifest(TileExporter& ex)
+{
+    std::ifstream file(ex.tile_dir / TILE_MANIFEST_NAME);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    Str line;
+    u32 tile_size = 0;
+
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream iss(line);
+
+        if (!tile_size)
+        {
+            iss >> tile_size;
+            continue;
+        }
+
+        u32 x = 0;
+        u32 y = 0;
+        u64 h = 0;
+
+        if ((iss >> x >> y >> std::hex >> h) && x < MAP_WIDTH && y < MAP_HEIGHT)
+        {
+            ex.hashes[y * MAP_WIDTH + x] = h;
+        }
+    }
+
+    return tile_size == TILE_SIZE;
+}
+
+
+static void write_tile_manifest(TileExporter const& ex)
+{
+    std::ostringstream oss;
+    oss << "# tile size, then x y hash of each screen the tiles were made from\n";
+    oss << TILE_SIZE << "\n";
+
+    for (u32 y = 0; y < MAP_HEIGHT; y++)
+    {
+        for (u32 x = 0; x < MAP_WIDTH; x++)
+        {
+            oss << x << " " << y << " " << std::hex << ex.hashes[y * MAP_WIDTH + x] << std::dec << "\n";
+        }
+    }
+
+    std::ofstream file(ex.tile_dir / TILE_MANIFEST_NAME);
+    file << oss.str();
+    file.close();
+}
+
+
+static void export_tiles(TileExporter& ex, ScreenFlags const& screens, bool all)
+{
+    auto& pyramid = ex.pyramid;
+
+    std::vector<u8> marks[mip::MAX_LEVELS];
+    for (u32 i = 0; i < pyramid.n_levels; i++)
+    {
+        auto const& grid = pyramid.tiles[i];
+        marks[i].assign(grid.width * grid.height, all ? 1 : 0);
+    }
+
+    for (u32 s = 0; s < screens.size() && !all; s++)
+    {
+        if (!screens[s])
+        {
+            continue;
+        }
+
+        auto r = screen_rect(s % MAP_WIDTH, s / MAP_WIDTH);
+
+        mip::invalidate(pyramid, r);
+
+        for (u32 i = 0; i < pyramid.n_levels; i++)
+        {
+            auto const& grid = pyramid.tiles[i];
+
+            mip::for_each_tile(pyramid, i, r, [&](u32 x, u32 y) { marks[i][y * grid.width + x] = 1; });
+        }
+    }
+
+    // only stale tiles are regenerated
+    mip::update(pyramid);
+
+    for (u32 i = 0; i < pyramid.n_levels; i++)
+    {
+        auto const& grid = pyramid.tiles[i];
+        for (u32 y = 0; y < grid.height; y++)
+        {
+            for (u32 x = 0; x < grid.width; x++)
+            {
+                if (marks[i][y * grid.width + x])
+                {
+                    write_tile(ex, i, x, y);
+                }
+            }
+        }
+    }
+
+    auto base = img::make_view(ex.base);
+
+    for (u32 s = 0; s < screens.size(); s++)
+    {
+        if (all || screens[s])
+        {
+            ex.hashes[s] = img::hash(img::sub_view(base, screen_rect(s % MAP_WIDTH, s / MAP_WIDTH)));
+        }
+    }
+
+    write_tile_manifest(ex);
+}
+
+
+static void run_tile_export(TileExporter& ex)
+{
+    mip::update(ex.pyramid);
+
+    if (ex.write_all)
+    {
+        export_tiles(ex, {}, true);
+    }
+    else
+    {
+        // the map changed while the program was not running
+        export_tiles(ex, ex.changed, false);
+    }
+
+    auto base = img::make_view(ex.base);
+
+    while (true)
+    {
+        ScreenFlags screens{};
+
+        {
+            std::unique_lock<std::mutex> lock(ex.mutex);
+            ex.cv.wait(lock, [&](){ return ex.stop || ex.n_pending; });
+
+            if (!ex.n_pending)
+            {
+                break;
+            }
+
+            for (u32 s = 0; s < screens.size(); s++)
+            {
+                if (!ex.pending[s])
+                {
+                    continue;
+                }
+
+                auto dst = img::sub_view(base, screen_rect(s % MAP_WIDTH, s / MAP_WIDTH));
+                img::copy(img::sub_view(img::make_view(ex.staged[s])), dst);
+
+                ex.pending[s] = false;
+                screens[s] = true;
+            }
+
+            ex.n_pending = 0;
+        }
+
+        export_tiles(ex, screens, false);
+    }
+}
+
+
+static void destroy_tile_export(TileExporter& ex)
+{
+    mip::destroy(ex.pyramid);
+    img::destroy_image(ex.base);
+
+    for (auto& image : ex.staged)
+    {
+        img::destroy_image(image);
+    }
+}
+
+
+static bool start_tile_export(TileExporter& ex, fs::path const& tile_dir, img::ImageView const& map)
+{
+    ex.tile_dir = tile_dir;
+
+    if (!img::create_image(ex.base, map.width, map.height))
+    {
+        destroy_tile_export(ex);
+        return false;
+    }
+
+    auto base = img::make_view(ex.base);
+    img::copy(img::sub_view(map), base);
+
+    if (!mip::create(ex.pyramid, base, TILE_SIZE))
+    {
+        destroy_tile_export(ex);
+        return false;
+    }
+
+    // tiles from a previous session are kept where the manifest says they match the map
+    ex.write_all = !load_tile_manifest(ex);
+
+    for (u32 s = 0; s < ex.changed.size() && !ex.write_all; s++)
+    {
+        auto h = img::hash(img::sub_view(base, screen_rect(s % MAP_WIDTH, s / MAP_WIDTH)));
+        ex.changed[s] = h != ex.hashes[s];
+    }
+
+    std::error_code ec;
+    for (u32 i = 0; i < ex.pyramid.n_levels; i++)
+    {
+        fs::create_directories(tile_dir / std::to_string(i), ec);
+    }
+
+    ex.thread = std::thread(run_tile_export, std::ref(ex));
+
+    return true;
+}
+
+
+static void stop_tile_export(TileExporter& ex)
+{
+    if (!ex.thread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ex.mutex);
+        ex.stop = true;
+    }
+
+    ex.cv.notify_one();
+    ex.thread.join();
+
+    destroy_tile_export(ex);
+}
+
+
+static void post_screens(TileExporter& ex, img::ImageView const& map, ScreenFlags const& screens)
+{
+    if (!ex.thread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ex.mutex);
+
+        for (u32 s = 0; s < screens.size(); s++)
+        {
+            if (!screens[s])
+            {
+                continue;
+            }
+
+            auto& staged = ex.staged[s];
+            if (!staged.data_ && !img::create_image(staged, GAME_SCREEN_WIDTH, GAME_SCREEN_HEIGHT))
+            {
+                continue;
+            }
+
+            auto src = img::sub_view(map, screen_rect(s % MAP_WIDTH, s / MAP_WIDTH));
+            img::copy(src, img::make_view(staged));
+
+            if (!ex.pending[s])
+            {
+                ex.pending[s] = true;
+                ex.n_pending++;
+            }
+        }
+    }
+
+    ex.cv.notify_one();
+}
+
+
+/*  worker pool
+
+    threads started once, parallel_for hands them the items of a loop
+    the calling thread works on its own loop too, so a loop finishes even when every worker is busy
+    loops from several threads share the workers
+*/
+
+class WorkerJob
+{
+public:
+    void (*run)(void* ctx, u32 i) = nullptr;
+    void* ctx = nullptr;
+
+    u32 n = 0;
+    std::atomic<u32> next = 0;
+
+    // workers on this job, guarded by the pool mutex
+    u32 n_workers = 0;
+};
+
+
+class WorkerPool
+{
+public:
+    std::vector<std::thread> threads;
+
+    // jobs with items left
+    std::vector<WorkerJob*> jobs;
+    bool stop = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable cv_done;
+};
+
+
+static void run_job_items(WorkerJob& job)
+{
+    for (u32 i = job.next++; i < job.n; i = job.next++)
+    {
+        job.run(job.ctx, i);
+    }
+}
+
+
+// the pool mutex must be locked
+static void remove_job(WorkerPool& pool, WorkerJob* job)
+{
+    auto it = std::find(pool.jobs.begin(), pool.jobs.end(), job);
+    if (it != pool.jobs.end())
+    {
+        pool.jobs.erase(it);
+    }
+}
+
+
+static void run_worker(WorkerPool& pool)
+{
+    trace::set_thread_name("worker");
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+
+    while (true)
+    {
+        pool.cv.wait(lock, [&]() { return pool.stop || !pool.jobs.empty(); });
+
+        if (pool.stop)
+        {
+            return;
+        }
+
+        auto job = pool.jobs.front();
+        job->n_workers++;
+
+        lock.unlock();
+        run_job_items(*job);
+        lock.lock();
+
+        // all items are taken
+        remove_job(pool, job);
+
+        if (--job->n_workers == 0)
+        {
+            pool.cv_done.notify_all();
+        }
+    }
+}
+
+
+static void start_worker_pool(WorkerPool& pool)
+{
+    auto n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the calling thread is the last one
+    for (u32 i = 1; i < n_threads; i++)
+    {
+        pool.threads.emplace_back(run_worker, std::ref(pool));
+    }
+}
+
+
+static void stop_worker_pool(WorkerPool& pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stop = true;
+    }
+
+    pool.cv.notify_all();
+
+    for (auto& th : pool.threads)
+    {
+        th.join();
+    }
+
+    pool.threads.clear();
+}
+
+
+// func(i) for i in [0, n), without workers the calling thread does all of them
+template <class F>
+static void parallel_for(WorkerPool& pool, u32 n, F const& func)
+{
+    WorkerJob job;
+    job.run = [](void* ctx, u32 i) { (*(F const*)ctx)(i); };
+    job.ctx = (void*)&func;
+    job.n = n;
+
+    if (n > 1 && !pool.threads.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.jobs.push_back(&job);
+        }
+
+        pool.cv.notify_all();
+    }
+
+    run_job_items(job);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    remove_job(pool, &job);
+
+    // items taken by workers may still be running
+    pool.cv_done.wait(lock, [&]() { return job.n_workers == 0; });
+}
+
+
+/* screen export */
+
+class ScreenExporter
+{
+public:
+    // content hash of each screen as last written, 0 when not written
+    std::array<u64, MAP_WIDTH * MAP_HEIGHT> hashes{};
+
+    bool manifest_loaded = false;
+};
+
+
+static Str screen_file_name(u32 screen_x, u32 screen_y)
+{
+    std::ostringstream oss;
+    oss << "tile_" << std::setfill('0') << std::setw(2) << screen_x << "_" << std::setw(2) << screen_y << ".png";
+
+    return oss.str();
+}
+
+
+static bool is_populated(img::SubView const& screen)
+{
+    auto const empty = img::to_pixel(0);
+
+    for (u32 y = 0; y < screen.height; y++)
+    {
+        auto row = img::row_begin(screen, y);
+        for (u32 x = 0; x < screen.width; x++)
+        {
+            auto p = row[x];
+            if (p.red != empty.red || p.green != empty.green || p.blue != empty.blue)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+static void load_screen_manifest(ScreenExporter& ex, fs::path const& dir)
+{
+    ex.manifest_loaded = true;
+
+    std::ifstream file(dir / SCREEN_EXPORT_MANIFEST_NAME);
+    if (!file.is_open())
+    {
+        return;
+    }
+
+    Str line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        Str name;
+        u32 x = 0;
+        u32 y = 0;
+        u64 h = 0;
+
+        std::istringstream iss(line);
+        if (!(iss >> name >> x >> y >> std::hex >> h) || x >= MAP_WIDTH || y >= MAP_HEIGHT)
+        {
+            continue;
+        }
+
+        // a deleted image has to be written again
+        if (fs::exists(dir / name))
+        {
+            ex.hashes[y * MAP_WIDTH + x] = h;
+        }
+    }
+}
+
+
+static void write_screen_manifest(ScreenExporter const& ex, fs::path const& dir)
+{
+    std::ostringstream oss;
+    oss << "# file x y hash\n";
+
+    for (u32 y = 0; y < MAP_HEIGHT; y++)
+    {
+        for (u32 x = 0; x < MAP_WIDTH; x++)
+        {
+            auto h = ex.hashes[y * MAP_WIDTH + x];
+            if (!h)
+            {
+                continue;
+            }
+
+            oss << screen_file_name(x, y) << " " << x << " " << y << " " << std::hex << h << std::dec << "\n";
+        }
+    }
+
+    std::ofstream file(dir / SCREEN_EXPORT_MANIFEST_NAME);
+    file << oss.str();
+    file.close();
+}
+
+
+static u32 export_screens(ScreenExporter& ex, WorkerPool& pool, fs::path const& dir, img::ImageView const& map)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    if (!ex.manifest_loaded)
+    {
+        load_screen_manifest(ex, dir);
+    }
+
+    std::atomic<u32> n_written = 0;
+
+    // screens are written straight from the map
+    parallel_for(pool, MAP_WIDTH * MAP_HEIGHT, [&](u32 s)
+    {
+        auto x = s % MAP_WIDTH;
+        auto y = s / MAP_WIDTH;
+        auto screen = img::sub_view(map, screen_rect(x, y));
+
+        if (!is_populated(screen))
+        {
+            return;
+        }
+
+        auto h = img::hash(screen);
+        if (h == ex.hashes[s])
+        {
+            return;
+        }
+
+        auto path = dir / screen_file_name(x, y);
+        if (img::write_to_file(screen, path.generic_string().c_str()))
+        {
+            ex.hashes[s] = h;
+            n_written++;
+        }
+    });
+
+    write_screen_manifest(ex, dir);
+
+    return n_written;
+}
+
+
+/* screen cache */
+
+class ScreenCacheEntry
+{
+public:
+    img::Image image;
+
+    // screens changed on the map since the image was rendered
+    ScreenFlags stale{};
+
+    u64 last_used = 0;
+};
+
+
+class ScreenCache
+{
+public:
+    std::array<ScreenCacheEntry, SCREEN_CACHE_SIZE> entries;
+
+    u64 use_count = 0;
+};
+
+
+static void destroy_screen_cache(ScreenCache& cache)
+{
+    for (auto& entry : cache.entries)
+    {
+        img::destroy_image(entry.image);
+        entry.last_used = 0;
+    }
+}
+
+
+static void invalidate_screen_cache(ScreenCache& cache, ScreenFlags const& updated)
+{
+    for (auto& entry : cache.entries)
+    {
+        for (u32 s = 0; s < updated.size(); s++)
+        {
+            entry.stale[s] = entry.stale[s] || updated[s];
+        }
+    }
+}
+
+
+/*  screen samples
+
+    the last MAX_SCREEN_SAMPLES play fields of each screen are kept as indices into a palette of that screen
+    the screen is written as the most common color of each pixel, so sprites that move
+    between samples are left out
+    with one or two samples, or a tie, the newest sample wins
+    when the palette is full it is rebuilt from the samples that are kept, dropping the oldest until the new one fits
+*/
+
+class ScreenPalette
+{
+public:
+    // the colors of the samples in the history, at most 256
+    std::unordered_map<u32, u8> indices;
+    img::Pixel colors[MAX_PALETTE_COLORS];
+    u32 n_colors = 0;
+};
+
+
+class SampleHistory
+{
+public:
+    ScreenPalette palette;
+
+    // MAX_SCREEN_SAMPLES play fields, allocated with the first sample
+    std::vector<u8> indices;
+
+    u32 n_samples = 0;
+
+    // the oldest sample once full
+    u32 next = 0;
+
+    // mean luminance of the last frame written, kept when the samples are dropped, 0 before the first
+    u32 luma = 0;
+};
+
+
+class ScreenSamples
+{
+public:
+    std::array<SampleHistory, MAP_WIDTH * MAP_HEIGHT> screens;
+};
+
+
+/* camera */
+
+class Camera
+{
+public:
+    // window pixels per map pixel, 0 shows the whole map stretched to the window
+    f32 zoom = 0.0f;
+
+    // map position at the top left of the window
+    f32 x = 0.0f;
+    f32 y = 0.0f;
+
+    bool dragging = false;
+
+    // not yet sent to the processing thread
+    bool changed = false;
+};
+
+
+/* frame handoff */
+
+constexpr u32 MAX_FRAME_RECTS = 16;
+constexpr u32 FRAME_FRESH = 4;
+
+
+class RectList
+{
+public:
+    Rect2Du32 rects[MAX_FRAME_RECTS];
+    u32 count = 0;
+
+    // the whole frame, or more rects than can be tracked
+    bool all = false;
+};
+
+
+class ScreenFrame
+{
+public:
+    img::Image image;
+
+    u64 id = 0;
+
+    // regions that differ from the frame published before this one
+    RectList changed;
+
+    // regions changed by newer frames, rendered again before this buffer is reused
+    RectList pending;
+};
+
+
+/*  lock-free triple buffer of finished screen frames
+    the processing thread renders into the back frame and swaps it with the middle one
+    the render thread swaps its front frame with the middle one when that one is fresh
+*/
+class FrameHandoff
+{
+public:
+    std::array<ScreenFrame, 3> frames;
+
+    // index of the middle frame, FRAME_FRESH when not yet taken
+    std::atomic<u32> middle = 1;
+
+    // processing thread only
+    u32 back = 0;
+    u64 next_id = 1;
+
+    // render thread only
+    u32 front = 2;
+    u64 shown_id = 0;
+};
+
+
+// requests from the render and decode threads to the processing thread
+class ProcessControl
+{
+public:
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    Camera camera;
+    Vec2Du32 screen_dim{};
+    bool view_changed = false;
+
+    bool save_map = false;
+    bool save_screens = false;
+
+    bool images_ready = false;
+};
+
+
+// metric ids, registered in main_init
+class AppMetrics
+{
+public:
+    // counters
+    u32 files_seen;
+    u32 watch_overflows;
+    u32 files_rescanned;
+    u32 images_decoded;
+    u32 read_retries;
+    u32 decode_failed;
+    u32 bytes_decoded;
+    u32 screens_written;
+    u32 screens_rejected;
+    u32 screens_invalid;
+    u32 stream_frames;
+    u32 stream_commits;
+    u32 video_frames;
+    u32 video_decoded;
+    u32 video_screens;
+
+    // gauges
+    u32 queue_depth;
+    u32 palette_colors;
+};
+
+
+class AppState
+{
+public:
+    AppSettings settings;
+
+    RunOptions options;
+
+    DirectoryWatch watch;
+
+    ImageQueue image_queue;
+
+    Image map_image;
+    img::ImageView map_view;
+    
+    // processing thread
+    ScreenCache screen_cache;
+    ScreenSamples screen_samples;
+
+    // lazily updated, only the tiles in view
+    mip::Pyramid map_pyramid;
+
+    ProcessControl control;
+    FrameHandoff frames;
+    u32 frame_event_type;
+
+    // render thread
+    sdl::ScreenMemory screen;
+    Camera camera;
+    Vec2Du32 view_dim{};
+
+    TileExporter tile_export;
+    ScreenExporter screen_export;
+
+    // parallel_for, started once the first frame is shown
+    WorkerPool workers;
+
+    std::atomic<RunState> run_state;
+
+    pacing::FramePacer pacer;
+
+    // screenshots applied to the map and published in a frame
+    std::atomic<u32> n_files_shown = 0;
+
+    // images taken from the queue, rejected ones included
+    std::atomic<u32> n_files_processed = 0;
+
+    AppMetrics metrics;
+
+    // ns, decode and save run on different threads than the stats writer
+    timing::Histogram decode_times;
+    timing::Histogram save_times;
+
+    // work per streamed frame, not counting the read
+    timing::Histogram stream_times;
+
+    FrameStream stream;
+
+    VideoSource video;
+
+    pacing::Clock::time_point start_time;
+    pacing::Clock::time_point next_stats_time;
+};
+
+
+static AppState state;
+
+
+static bool is_running()
+{
+    return state.run_state == RunState::Running;
+}
+
+
+static void end_program()
+{
+    state.run_state = RunState::End;
+}
+
+
+// the file is complete and ready to decode, the queue must be locked
+static void mark_new(ImageQueue& queue, fs::path const& path)
+{
+    auto it = queue.files.find(path);
+    if (it == queue.files.end() || it->second.status == FileStatus::Deleted)
+    {
+        metrics::add(state.metrics.files_seen);
+    }
+
+    queue.files[path].status = FileStatus::New;
+    queue.pending.push_back(path);
+}
+
+
+// the queue must be locked
+static void mark_deleted(ImageQueue& queue, fs::path const& path)
+{
+    auto it = queue.files.find(path);
+    if (it != queue.files.end())
+    {
+        it->second.status = FileStatus::Deleted;
+    }
+}
+
+
+// filtered output is not exactly gray
+static bool is_hud_gray(img::Pixel p)
+{
+    auto lo = std::min({ p.red, p.green, p.blue });
+    auto hi = std::max({ p.red, p.green, p.blue });
+
+    return lo >= DARK_LUMA && (u32)(hi - lo) <= HUD_GRAY_TOLERANCE;
+}
+
+
+// the position marker is a color, filtering only blends it a little with the gray around it
+static bool is_map_marker(img::Pixel p)
+{
+    auto lo = std::min({ p.red, p.green, p.blue });
+    auto hi = std::max({ p.red, p.green, p.blue });
+
+    return (u32)(hi - lo) > HUD_GRAY_TOLERANCE;
+}
+
+
+/*  position on the map from the mini-map at the top of the screen
+    each screen is a 4x4 cell of the mini-map, the cell with the most marker pixels wins
+    so color bleeding into a neighbor, as 4:2:0 chroma does, does not move the position
+*/
+static bool locate_screen(img::ImageView const& src, Point2Du32& screen)
+{
+    constexpr u32 cell = 4;
+
+    // mini-map at top of screen
+    Rect2Du32 rm{};
+    rm.x_begin = 16;
+    rm.x_end = rm.x_begin + MAP_WIDTH * cell;
+    rm.y_begin = 16;
+    rm.y_end = rm.y_begin + MAP_HEIGHT * cell;
+
+    auto vm = img::sub_view(src, rm);
+
+    u32 counts[MAP_WIDTH * MAP_HEIGHT] = { 0 };
+
+    TRACE_SCOPE("locate");
+
+    for (u32 y = 0; y < vm.height; y++)
+    {
+        auto row = img::row_begin(vm, y);
+        auto cells = counts + (y / cell) * MAP_WIDTH;
+
+        for (u32 x = 0; x < vm.width; x++)
+        {
+            cells[x / cell] += is_map_marker(row[x]);
+        }
+    }
+
+    u32 best = 0;
+    for (u32 i = 1; i < MAP_WIDTH * MAP_HEIGHT; i++)
+    {
+        best = counts[i] > counts[best] ? i : best;
+    }
+
+    if (!counts[best])
+    {
+        return false;
+    }
+
+    screen.x = best % MAP_WIDTH;
+    screen.y = best / MAP_WIDTH;
+
+    return true;
+}
+
+
+// frames must be large enough for the mini-map and the play field below it
+static bool has_play_field(Vec2Du32 dim)
+{
+    return dim.x >= GAME_SCREEN_WIDTH && dim.y >= GAME_SCREEN_HEIGHT + HUD_MIN_HEIGHT;
+}
+
+
+// play field at the bottom of the screen
+static Rect2Du32 play_field_rect(img::ImageView const& src)
+{
+    return img::make_rect(0, src.height - GAME_SCREEN_HEIGHT, GAME_SCREEN_WIDTH, GAME_SCREEN_HEIGHT);
+}
+
+
+/*  input normalization
+
+    emulators save frames at an integer scale, some also crop up to MAX_OVERSCAN_CROP
+    rows or columns of overscan
+    the scale comes from the frame size, the crop offsets from where the mini-map's
+    gray border is found
+    frames are sampled down into a native size image, cropped parts are black
+*/
+
+static bool is_native_frame(Vec2Du32 dim)
+{
+    return dim.x == NES_FRAME_WIDTH && dim.y == NES_FRAME_HEIGHT;
+}
+
+
+// at most one scale fits since the crop is less than half the frame
+static bool find_frame_scale(Vec2Du32 dim, FrameLayout& layout)
+{
+    for (u32 scale = 1; scale <= MAX_FRAME_SCALE; scale++)
+    {
+        if (dim.x % scale || dim.y % scale)
+        {
+            continue;
+        }
+
+        auto w = dim.x / scale;
+        auto h = dim.y / scale;
+
+        if (w > NES_FRAME_WIDTH || h > NES_FRAME_HEIGHT ||
+            w + MAX_OVERSCAN_CROP < NES_FRAME_WIDTH || h + MAX_OVERSCAN_CROP < NES_FRAME_HEIGHT)
+        {
+            continue;
+        }
+
+        layout.scale = scale;
+        layout.dim = { w, h };
+
+        // centered unless the HUD says otherwise
+        layout.offset = { (NES_FRAME_WIDTH - w) / 2, (NES_FRAME_HEIGHT - h) / 2 };
+
+        return true;
+    }
+
+    return false;
+}
+
+
+// top left corner of the mini-map, native (16, 16), in the visible part of the frame
+static void find_crop_offset(img::ImageView const& src, FrameLayout& layout)
+{
+    constexpr u32 map_x = 16;
+    constexpr u32 map_y = 16;
+    constexpr u32 run = 16;
+
+    auto const s = layout.scale;
+
+    auto const sample = [&](u32 x, u32 y) { return *img::xy_at(src, x * s + s / 2, y * s + s / 2); };
+
+    auto crop_x = NES_FRAME_WIDTH - layout.dim.x;
+    auto crop_y = NES_FRAME_HEIGHT - layout.dim.y;
+
+    for (u32 y = map_y - std::min(crop_y, map_y); y <= map_y; y++)
+    {
+        for (u32 x = map_x - std::min(crop_x, map_x); x <= map_x; x++)
+        {
+            if ((x && is_hud_gray(sample(x - 1, y))) || (y && is_hud_gray(sample(x, y - 1))))
+            {
+                continue;
+            }
+
+            u32 n = 0;
+            while (n < run && is_hud_gray(sample(x + n, y)))
+            {
+                n++;
+            }
+
+            if (n == run)
+            {
+                layout.offset = { map_x - x, map_y - y };
+                return;
+            }
+        }
+    }
+}
+
+
+static void scale_to_native(img::ImageView const& src, FrameLayout const& layout, img::ImageView const& dst)
+{
+    TRACE_SCOPE("normalize");
+
+    auto visible = img::make_rect(layout.offset.x, layout.offset.y, layout.dim.x, layout.dim.y);
+
+    if (layout.dim.x < NES_FRAME_WIDTH || layout.dim.y < NES_FRAME_HEIGHT)
+    {
+        img::fill(img::sub_view(dst), img::to_pixel(0));
+    }
+
+    img::scale_down_nearest(img::sub_view(src), layout.scale, img::sub_view(dst, visible));
+}
+
+
+// scaled or cropped frames are replaced by a native one, other sizes are left as they are
+static void normalize_frame(img::Image& image)
+{
+    Vec2Du32 dim = { image.width, image.height };
+
+    FrameLayout layout{};
+    if (is_native_frame(dim) || !find_frame_scale(dim, layout))
+    {
+        return;
+    }
+
+    auto src = img::make_view(image);
+    find_crop_offset(src, layout);
+
+    img::Image native;
+    if (!img::create_image(native, NES_FRAME_WIDTH, NES_FRAME_HEIGHT))
+    {
+        return;
+    }
+
+    scale_to_native(src, layout, img::make_view(native));
+
+    img::destroy_image(image);
+    image = native;
+}
+
+
+static u32 color_key(img::Pixel p)
+{
+    u32 key;
+    std::memcpy(&key, &p, sizeof(key));
+
+    return key;
+}
+
+
+// false when the palette is full
+static bool to_palette_indices(ScreenPalette& palette, img::SubView const& src, u8* dst)
+{
+    // neighboring pixels are mostly the same color
+    u32 last_key = color_key(*img::row_begin(src, 0)) + 1;
+    u8 last_index = 0;
+
+    for (u32 y = 0; y < src.height; y++)
+    {
+        auto s = img::row_begin(src, y);
+        auto d = dst + y * src.width;
+
+        for (u32 x = 0; x < src.width; x++)
+        {
+            auto key = color_key(s[x]);
+            if (key != last_key)
+            {
+                auto it = palette.indices.find(key);
+                if (it != palette.indices.end())
+                {
+                    last_index = it->second;
+                }
+                else if (palette.n_colors < MAX_PALETTE_COLORS)
+                {
+                    last_index = (u8)palette.n_colors;
+                    palette.colors[palette.n_colors++] = s[x];
+                    palette.indices[key] = last_index;
+                }
+                else
+                {
+                    return false;
+                }
+
+                last_key = key;
+            }
+
+            d[x] = last_index;
+        }
+    }
+
+    return true;
+}
+
+
+// per pixel mode of the samples, a row at a time
+static void write_sample_mode(SampleHistory const& history, img::SubView const& dst)
+{
+    constexpr u32 W = GAME_SCREEN_WIDTH;
+    constexpr u64 plane_size = (u64)GAME_SCREEN_WIDTH * GAME_SCREEN_HEIGHT;
+
+    auto const n = history.n_samples;
+
+    // newest first
+    u8 const* planes[MAX_SCREEN_SAMPLES];
+    for (u32 i = 0; i < n; i++)
+    {
+        auto k = (history.next + MAX_SCREEN_SAMPLES - 1 - i) % MAX_SCREEN_SAMPLES;
+        planes[i] = history.indices.data() + k * plane_size;
+    }
+
+    static_assert(W % 16 == 0);
+
+    u8 best[W];
+    u8 best_count[W];
+
+#ifndef __SSE2__
+    u8 count[W];
+#endif
+
+    for (u32 y = 0; y < GAME_SCREEN_HEIGHT; y++)
+    {
+        auto offset = (u64)y * W;
+
+        std::memcpy(best, planes[0] + offset, W);
+        std::memset(best_count, 0, W);
+
+        for (u32 i = 0; i < n; i++)
+        {
+            auto cand = planes[i] + offset;
+
+        #ifdef __SSE2__
+
+            // 16 pixels at a time, a match is -1 from cmpeq, counts are at most MAX_SCREEN_SAMPLES
+            for (u32 x = 0; x < W; x += 16)
+            {
+                auto c = _mm_loadu_si128((__m128i const*)(cand + x));
+                auto n_eq = _mm_setzero_si128();
+
+                for (u32 k = 0; k < n; k++)
+                {
+                    auto o = _mm_loadu_si128((__m128i const*)(planes[k] + offset + x));
+                    n_eq = _mm_sub_epi8(n_eq, _mm_cmpeq_epi8(o, c));
+                }
+
+                auto b = _mm_loadu_si128((__m128i const*)(best + x));
+                auto b_n = _mm_loadu_si128((__m128i const*)(best_count + x));
+                auto more = _mm_cmpgt_epi8(n_eq, b_n);
+
+                b = _mm_or_si128(_mm_and_si128(more, c), _mm_andnot_si128(more, b));
+                b_n = _mm_or_si128(_mm_and_si128(more, n_eq), _mm_andnot_si128(more, b_n));
+
+                _mm_storeu_si128((__m128i*)(best + x), b);
+                _mm_storeu_si128((__m128i*)(best_count + x), b_n);
+            }
+
+        #else
+
+            std::memset(count, 0, W);
+            for (u32 k = 0; k < n; k++)
+            {
+                auto other = planes[k] + offset;
+                for (u32 x = 0; x < W; x++)
+                {
+                    count[x] += (u8)(other[x] == cand[x]);
+                }
+            }
+
+            for (u32 x = 0; x < W; x++)
+            {
+                auto more = count[x] > best_count[x];
+                best[x] = more ? cand[x] : best[x];
+                best_count[x] = more ? count[x] : best_count[x];
+            }
+
+        #endif
+        }
+
+        auto d = img::row_begin(dst, y);
+        for (u32 x = 0; x < W; x++)
+        {
+            d[x] = history.palette.colors[best[x]];
+        }
+    }
+}
+
+
+// keeps the n_keep newest samples and only the colors they use
+static void rebuild_palette(SampleHistory& history, u32 n_keep)
+{
+    constexpr u64 plane_size = (u64)GAME_SCREEN_WIDTH * GAME_SCREEN_HEIGHT;
+
+    auto& palette = history.palette;
+
+    constexpr u32 unused = MAX_PALETTE_COLORS;
+
+    u32 remap[MAX_PALETTE_COLORS];
+    std::fill_n(remap, MAX_PALETTE_COLORS, unused);
+
+    img::Pixel colors[MAX_PALETTE_COLORS];
+    u32 n_colors = 0;
+
+    for (u32 i = 0; i < n_keep; i++)
+    {
+        auto k = (history.next + MAX_SCREEN_SAMPLES - 1 - i) % MAX_SCREEN_SAMPLES;
+        auto plane = history.indices.data() + k * plane_size;
+
+        for (u64 p = 0; p < plane_size; p++)
+        {
+            auto& r = remap[plane[p]];
+            if (r == unused)
+            {
+                r = n_colors;
+                colors[n_colors++] = palette.colors[plane[p]];
+            }
+
+            plane[p] = (u8)r;
+        }
+    }
+
+    palette.indices.clear();
+    for (u32 i = 0; i < n_colors; i++)
+    {
+        palette.colors[i] = colors[i];
+        palette.indices[color_key(colors[i])] = (u8)i;
+    }
+
+    palette.n_colors = n_colors;
+    history.n_samples = n_keep;
+}
+
+
+// only the screen that got the sample is recomputed
+static void add_screen_sample(SampleHistory& history, img::SubView const& src, img::SubView const& dst)
+{
+    constexpr u64 plane_size = (u64)GAME_SCREEN_WIDTH * GAME_SCREEN_HEIGHT;
+
+    if (history.indices.empty())
+    {
+        history.indices.resize(MAX_SCREEN_SAMPLES * plane_size);
+    }
+
+    auto plane = history.indices.data() + history.next * plane_size;
+
+    // the slot of the new sample is the oldest one once the history is full
+    auto n_keep = std::min(history.n_samples, MAX_SCREEN_SAMPLES - 1);
+
+    for (;;)
+    {
+        auto was_empty = !history.palette.n_colors;
+        if (to_palette_indices(history.palette, src, plane))
+        {
+            break;
+        }
+
+        if (was_empty)
+        {
+            // more colors in one sample than a palette holds, nothing to count
+            rebuild_palette(history, 0);
+            img::copy(src, dst);
+            return;
+        }
+
+        rebuild_palette(history, n_keep);
+        n_keep = n_keep ? n_keep - 1 : 0;
+    }
+
+    history.next = (history.next + 1) % MAX_SCREEN_SAMPLES;
+    history.n_samples = std::min(history.n_samples + 1, MAX_SCREEN_SAMPLES);
+
+    write_sample_mode(history, dst);
+}
+
+
+/* frame validation */
+
+class PlayFieldStats
+{
+public:
+    u32 n_pixels = 0;
+
+    // sum of luminance, and pixels with less than DARK_LUMA
+    u64 luma_total = 0;
+    u32 n_dark = 0;
+
+    // occupied bins of a 3-3-2 bit color histogram
+    u32 n_colors = 0;
+};
+
+
+static u32 color_bin(img::Pixel p)
+{
+    return (p.red & 0xE0) | ((p.green & 0xE0) >> 3) | (p.blue >> 6);
+}
+
+
+#ifdef __SSE2__
+
+// luminance and histogram bins of 8 pixels as 16 bit lanes
+static void luma_bins_8(img::Pixel const* src, __m128i& luma, __m128i& bins)
+{
+    auto const mask = _mm_set1_epi32(0xFF);
+
+    auto v0 = _mm_loadu_si128((__m128i const*)src);
+    auto v1 = _mm_loadu_si128((__m128i const*)(src + 4));
+
+    auto r = _mm_packs_epi32(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask));
+    auto g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 8), mask), _mm_and_si128(_mm_srli_epi32(v1, 8), mask));
+    auto b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 16), mask), _mm_and_si128(_mm_srli_epi32(v1, 16), mask));
+
+    // at most 255 * 256, wraps as a signed lane but not as an unsigned one
+    luma = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    luma = _mm_srli_epi16(_mm_add_epi16(luma, _mm_mullo_epi16(b, _mm_set1_epi16(29))), 8);
+
+    auto const top3 = _mm_set1_epi16(0xE0);
+    bins = _mm_or_si128(_mm_and_si128(r, top3), _mm_srli_epi16(_mm_and_si128(g, top3), 3));
+    bins = _mm_or_si128(bins, _mm_srli_epi16(b, 6));
+}
+
+#endif
+
+
+// one pass, the histogram only records which bins are occupied
+static PlayFieldStats play_field_stats(img::SubView const& view)
+{
+    PlayFieldStats stats{};
+
+    u8 occupied[256] = { 0 };
+
+    for (u32 y = 0; y < view.height; y++)
+    {
+        auto row = img::row_begin(view, y);
+
+        u64 row_luma = 0;
+        u32 row_dark = 0;
+
+        u32 x = 0;
+
+    #ifdef __SSE2__
+
+        auto const zero = _mm_setzero_si128();
+        auto const one = _mm_set1_epi8(1);
+        auto const dark_max = _mm_set1_epi8((char)(DARK_LUMA - 1));
+
+        // sad against zero sums the bytes into two 64 bit lanes
+        auto luma_sum = zero;
+        auto dark_sum = zero;
+
+        alignas(16) u8 bins[16];
+
+        // 16 pixels
+        for (; x + 16 <= view.width; x += 16)
+        {
+            __m128i luma_lo;
+            __m128i luma_hi;
+            __m128i bins_lo;
+            __m128i bins_hi;
+            luma_bins_8(row + x, luma_lo, bins_lo);
+            luma_bins_8(row + x + 8, luma_hi, bins_hi);
+
+            auto luma = _mm_packus_epi16(luma_lo, luma_hi);
+
+            luma_sum = _mm_add_epi64(luma_sum, _mm_sad_epu8(luma, zero));
+
+            // 1 where luma < DARK_LUMA
+            auto dark = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(luma, dark_max), luma), one);
+            dark_sum = _mm_add_epi64(dark_sum, _mm_sad_epu8(dark, zero));
+
+            auto bins8 = _mm_packus_epi16(bins_lo, bins_hi);
+            auto first = _mm_cvtsi128_si32(bins8) & 0xFF;
+
+            // mostly runs of one color
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(bins8, _mm_set1_epi8((char)first))) == 0xFFFF)
+            {
+                occupied[first] = 1;
+                continue;
+            }
+
+            _mm_store_si128((__m128i*)bins, bins8);
+            for (u32 i = 0; i < 16; i++)
+            {
+                occupied[bins[i]] = 1;
+            }
+        }
+
+        alignas(16) u64 parts[2];
+
+        _mm_store_si128((__m128i*)parts, luma_sum);
+        row_luma += parts[0] + parts[1];
+
+        _mm_store_si128((__m128i*)parts, dark_sum);
+        row_dark += (u32)(parts[0] + parts[1]);
+
+    #endif
+
+        for (; x < view.width; x++)
+        {
+            auto p = row[x];
+            auto luma = ((u32)p.red * 77 + (u32)p.green * 150 + (u32)p.blue * 29) >> 8;
+
+            row_luma += luma;
+            row_dark += luma < DARK_LUMA;
+            occupied[color_bin(p)] = 1;
+        }
+
+        stats.luma_total += row_luma;
+        stats.n_dark += row_dark;
+    }
+
+    for (auto n : occupied)
+    {
+        stats.n_colors += n;
+    }
+
+    stats.n_pixels = view.width * view.height;
+
+    return stats;
+}
+
+
+static u32 mean_luma(PlayFieldStats const& stats)
+{
+    return stats.n_pixels ? (u32)(stats.luma_total / stats.n_pixels) : 0;
+}
+
+
+/*  the HUD is black left of the mini-map and the mini-map is gray but for the position markers
+    the pause subscreen moves the HUD down, so the mini-map area shows something else
+*/
+static bool has_hud(img::ImageView const& src)
+{
+    auto map_r = img::make_rect(16, 16, 64, 32);
+    auto border_r = img::make_rect(0, 16, 16, 32);
+
+    auto vm = img::sub_view(src, map_r);
+    auto vb = img::sub_view(src, border_r);
+
+    u32 n_gray = 0;
+    for (u32 y = 0; y < vm.height; y++)
+    {
+        auto row = img::row_begin(vm, y);
+        for (u32 x = 0; x < vm.width; x++)
+        {
+            n_gray += is_hud_gray(row[x]);
+        }
+    }
+
+    // filtering bleeds the mini-map into the column next to it
+    u32 n_dark = 0;
+    for (u32 y = 0; y < vb.height; y++)
+    {
+        auto row = img::row_begin(vb, y);
+        for (u32 x = 0; x < vb.width; x++)
+        {
+            auto p = row[x];
+            n_dark += (p.red | p.green | p.blue) < DARK_LUMA;
+        }
+    }
+
+    auto gray = n_gray * 100 >= vm.width * vm.height * MIN_HUD_GRAY_PERCENT;
+    auto dark = n_dark * 100 >= vb.width * vb.height * MIN_HUD_GRAY_PERCENT;
+
+    return gray && dark;
+}
+
+
+/*  rejects frames that would put garbage on the map
+    open menus: the HUD is not where it should be
+    black and single color frames: the play field is nearly all dark or has too few colors
+    fades: the play field is much darker than the last sample of the same screen
+*/
+static bool is_valid_frame(img::ImageView const& src, SampleHistory const& history, u32& luma)
+{
+    TRACE_SCOPE("validate");
+
+    if (!has_hud(src))
+    {
+        return false;
+    }
+
+    auto stats = play_field_stats(img::sub_view(src, play_field_rect(src)));
+
+    if (stats.n_dark * 100 >= stats.n_pixels * MAX_DARK_PERCENT || stats.n_colors < MIN_PLAY_FIELD_COLORS)
+    {
+        return false;
+    }
+
+    luma = mean_luma(stats);
+
+    return luma * 100 >= history.luma * MIN_FADE_LUMA_PERCENT;
+}
+
+
+enum class MapWrite : int
+{
+    Written = 0,
+
+    // no mini-map position found
+    NotLocated,
+
+    // rejected by is_valid_frame
+    Invalid
+};
+
+
+static MapWrite write_map(ScreenSamples& samples, img::ImageView const& src, img::ImageView const& map, Point2Du32& screen)
+{
+    if (!locate_screen(src, screen))
+    {
+        return MapWrite::NotLocated;
+    }
+
+    auto& history = samples.screens[screen.y * MAP_WIDTH + screen.x];
+
+    u32 luma = 0;
+    if (!is_valid_frame(src, history, luma))
+    {
+        return MapWrite::Invalid;
+    }
+
+    auto dst = img::sub_view(map, screen_rect(screen.x, screen.y));
+
+    TRACE_SCOPE("blit");
+
+    add_screen_sample(history, img::sub_view(src, play_field_rect(src)), dst);
+
+    history.luma = luma;
+
+    return MapWrite::Written;
+}
+
+
+// the queue must be locked
+static void queue_image(ImageQueue& queue, img::Image const& image)
+{
+    queue.images.push_back(image);
+    queue.queued_ns.push_back(trace::now_ns());
+    metrics::set(state.metrics.queue_depth, (i64)queue.images.size());
+}
+
+
+static void notify_images_ready(ProcessControl& control)
+{
+    {
+        std::lock_guard<std::mutex> lock(control.mutex);
+        control.images_ready = true;
+    }
+
+    control.cv.notify_one();
+}
+
+
+// a file being read by the decode thread
+class ReadJob
+{
+public:
+    fs::path path;
+
+    u32 attempts = 0;
+    i64 retry_ns = 0;
+
+    fs::file_time_type decoded_time{};
+};
+
+
+#ifdef _WIN32
+
+// the writer still has the file open
+static bool is_file_locked(fs::path const& path)
+{
+    auto h = CreateFileW(path.wstring().c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        return GetLastError() == ERROR_SHARING_VIOLATION;
+    }
+
+    CloseHandle(h);
+
+    return false;
+}
+
+#else
+
+// files are only reported once closed after writing or renamed into place
+static bool is_file_locked(fs::path const&)
+{
+    return false;
+}
+
+#endif
+
+
+// takes the file from the watcher if it still has the expected status, the queue must be locked
+static bool claim_file(ImageQueue& queue, ReadJob& job, FileStatus expected)
+{
+    auto it = queue.files.find(job.path);
+    if (it == queue.files.end() || it->second.status != expected)
+    {
+        return false;
+    }
+
+    it->second.status = FileStatus::Existing;
+    job.decoded_time = it->second.decoded_time;
+
+    return true;
+}
+
+
+static void retry_read(ImageQueue& queue, ReadJob& job, std::vector<ReadJob>& retries)
+{
+    job.attempts++;
+
+    auto status = job.attempts < MAX_READ_ATTEMPTS ? FileStatus::Retry : FileStatus::Failed;
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        // reported again meanwhile, the new report is decoded instead
+        auto it = queue.files.find(job.path);
+        if (it == queue.files.end() || it->second.status != FileStatus::Existing)
+        {
+            return;
+        }
+
+        it->second.status = status;
+    }
+
+    if (status == FileStatus::Failed)
+    {
+        metrics::add(state.metrics.decode_failed);
+        return;
+    }
+
+    metrics::add(state.metrics.read_retries);
+
+    auto backoff_ms = std::min(READ_RETRY_MS << (job.attempts - 1), READ_RETRY_MAX_MS);
+    job.retry_ns = timing::now_ns() + (i64)backoff_ms * 1'000'000;
+
+    retries.push_back(job);
+}
+
+
+static void decode_images(AppSettings const& settings, ImageQueue& queue, ProcessControl& control)
+{
+    std::vector<ReadJob> jobs;
+    std::vector<ReadJob> retries;
+
+    trace::set_thread_name("decode");
+
+    while (is_running())
+    {
+        jobs.clear();
+
+        // wake up for the first retry that is due
+        auto wait_ns = (i64)WAIT_TIMEOUT_MS * 1'000'000;
+        auto now_ns = timing::now_ns();
+        for (auto const& job : retries)
+        {
+            wait_ns = std::max(std::min(wait_ns, job.retry_ns - now_ns), (i64)0);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.cv.wait_for(lock, std::chrono::nanoseconds(wait_ns), [&](){ return !queue.pending.empty() || !is_running(); });
+
+            // a file reported more than once is only claimed once
+            for (auto const& path : queue.pending)
+            {
+                ReadJob job{};
+                job.path = path;
+
+                if (claim_file(queue, job, FileStatus::New))
+                {
+                    jobs.push_back(job);
+                }
+            }
+
+            queue.pending.clear();
+
+            now_ns = timing::now_ns();
+            for (u32 i = 0; i < retries.size(); )
+            {
+                auto& job = retries[i];
+                if (job.retry_ns > now_ns)
+                {
+                    i++;
+                    continue;
+                }
+
+                if (claim_file(queue, job, FileStatus::Retry))
+                {
+                    jobs.push_back(job);
+                }
+
+                job = retries.back();
+                retries.pop_back();
+            }
+        }
+
+        bool decoded = false;
+
+        for (auto& job : jobs)
+        {
+            if (job.path.filename() == settings.map_save_path.filename())
+            {
+                continue;
+            }
+
+            std::error_code ec;
+            auto write_time = fs::last_write_time(job.path, ec);
+            if (ec)
+            {
+                // deleted or renamed since
+                continue;
+            }
+
+            if (write_time == job.decoded_time)
+            {
+                // this version was decoded already
+                continue;
+            }
+
+            if (is_file_locked(job.path))
+            {
+                retry_read(queue, job, retries);
+                continue;
+            }
+
+            auto full_path = job.path.generic_string();
+
+            auto begin_ns = timing::now_ns();
+
+            img::Image image;
+            if (!img::read_image_from_file(full_path.c_str(), image))
+            {
+                retry_read(queue, job, retries);
+                continue;
+            }
+
+            // one pair of timestamps for the histogram and the trace
+            auto end_ns = timing::now_ns();
+            timing::record(state.decode_times, end_ns - begin_ns);
+            trace::record_span("decode", begin_ns, end_ns);
+
+            metrics::add(state.metrics.images_decoded);
+            metrics::add(state.metrics.bytes_decoded, (u64)image.width * image.height * sizeof(img::Pixel));
+
+            normalize_frame(image);
+
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            auto it = queue.files.find(job.path);
+            if (it != queue.files.end())
+            {
+                it->second.decoded_time = write_time;
+            }
+
+            queue_image(queue, image);
+            decoded = true;
+        }
+
+        if (decoded)
+        {
+            notify_images_ready(control);
+        }
+    }
+}
+
+
+#ifdef _WIN32
+
+static bool open_stream(FrameStream& stream, Str const& path)
+{
+    if (path == "-")
+    {
+        stream.handle = GetStdHandle(STD_INPUT_HANDLE);
+        stream.is_stdin = true;
+    }
+    else
+    {
+        stream.handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    }
+
+    return stream.handle && stream.handle != INVALID_HANDLE_VALUE;
+}
+
+
+static void close_stream(FrameStream& stream)
+{
+    if (!stream.is_stdin && stream.handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(stream.handle);
+    }
+
+    stream.handle = INVALID_HANDLE_VALUE;
+}
+
+
+// blocks until there is data, 0 at the end of the stream
+static i64 read_stream(FrameStream& stream, u8* dst, u32 size)
+{
+    while (is_running())
+    {
+        // pipes are peeked so the program can close while the writer is idle, files are read directly
+        DWORD available = 0;
+        if (PeekNamedPipe(stream.handle, NULL, 0, NULL, &available, NULL) && !available)
+        {
+            Sleep(1);
+            continue;
+        }
+
+        DWORD n_read = 0;
+        if (!ReadFile(stream.handle, dst, size, &n_read, NULL))
+        {
+            return 0;
+        }
+
+        return n_read;
+    }
+
+    return 0;
+}
+
+#else
+
+static bool open_stream(FrameStream& stream, Str const& path)
+{
+    if (path == "-")
+    {
+        stream.fd = STDIN_FILENO;
+        stream.is_stdin = true;
+    }
+    else
+    {
+        // a FIFO opened without O_NONBLOCK blocks until there is a writer
+        stream.fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    }
+
+    return stream.fd >= 0;
+}
+
+
+static void close_stream(FrameStream& stream)
+{
+    if (!stream.is_stdin && stream.fd >= 0)
+    {
+        close(stream.fd);
+    }
+
+    stream.fd = -1;
+}
+
+
+// blocks until there is data, 0 at the end of the stream
+static i64 read_stream(FrameStream& stream, u8* dst, u32 size)
+{
+    pollfd pfd{};
+    pfd.fd = stream.fd;
+    pfd.events = POLLIN;
+
+    while (is_running())
+    {
+        if (poll(&pfd, 1, WAIT_TIMEOUT_MS) <= 0)
+        {
+            continue;
+        }
+
+        auto n_read = read(stream.fd, dst, size);
+        if (n_read < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            continue;
+        }
+
+        return n_read < 0 ? 0 : n_read;
+    }
+
+    return 0;
+}
+
+#endif
+
+
+static bool read_exact(FrameStream& stream, u8* dst, u64 size)
+{
+    while (size)
+    {
+        if (stream.begin == stream.end)
+        {
+            if (size >= stream.buffer.size())
+            {
+                // large reads go straight to dst
+                auto n_read = read_stream(stream, dst, (u32)std::min(size, (u64)INT32_MAX));
+                if (n_read <= 0)
+                {
+                    return false;
+                }
+
+                dst += n_read;
+                size -= n_read;
+                continue;
+            }
+
+            auto n_read = read_stream(stream, stream.buffer.data(), (u32)stream.buffer.size());
+            if (n_read <= 0)
+            {
+                return false;
+            }
+
+            stream.begin = 0;
+            stream.end = (u32)n_read;
+        }
+
+        auto n = (u32)std::min(size, (u64)(stream.end - stream.begin));
+        std::memcpy(dst, stream.buffer.data() + stream.begin, n);
+
+        stream.begin += n;
+        dst += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+
+static bool read_pam_header(FrameStream& stream, img::pam::Header& header)
+{
+    constexpr u32 end_size = 7;
+
+    u8 bytes[MAX_PAM_HEADER_SIZE];
+
+    for (u32 size = 1; size <= MAX_PAM_HEADER_SIZE; size++)
+    {
+        if (!read_exact(stream, bytes + size - 1, 1))
+        {
+            return false;
+        }
+
+        if (size >= end_size && !std::memcmp(bytes + size - end_size, "ENDHDR\n", end_size))
+        {
+            return img::pam::read_header(bytes, size, header);
+        }
+    }
+
+    return false;
+}
+
+
+// detects PAM frames from the first bytes, allocates everything needed while streaming
+static bool start_frame_stream(FrameStream& stream, RunOptions const& options)
+{
+    if (!open_stream(stream, options.stream_path))
+    {
+        return false;
+    }
+
+    stream.buffer.resize(STREAM_READ_SIZE);
+
+    while (stream.end < 3)
+    {
+        auto n_read = read_stream(stream, stream.buffer.data() + stream.end, STREAM_READ_SIZE - stream.end);
+        if (n_read <= 0)
+        {
+            return false;
+        }
+
+        stream.end += (u32)n_read;
+    }
+
+    auto bytes = stream.buffer.data();
+    stream.is_pam = bytes[0] == 'P' && bytes[1] == '7' && bytes[2] == '\n';
+
+    stream.dim = options.stream_dim;
+
+    if (stream.is_pam)
+    {
+        if (!read_pam_header(stream, stream.header))
+        {
+            return false;
+        }
+
+        stream.has_header = true;
+        stream.dim = { stream.header.width, stream.header.height };
+        stream.pixel_bytes.resize((u64)stream.dim.x * stream.dim.y * stream.header.depth);
+    }
+
+    stream.is_scaled = !is_native_frame(stream.dim) && find_frame_scale(stream.dim, stream.layout);
+
+    if (stream.is_scaled)
+    {
+        if (!img::create_image(stream.native, NES_FRAME_WIDTH, NES_FRAME_HEIGHT))
+        {
+            return false;
+        }
+    }
+    else if (!has_play_field(stream.dim))
+    {
+        return false;
+    }
+
+    return img::create_image(stream.frame, stream.dim.x, stream.dim.y);
+}
+
+
+static bool read_frame(FrameStream& stream, img::ImageView const& dst)
+{
+    if (!stream.is_pam)
+    {
+        return read_exact(stream, (u8*)dst.matrix_data_, (u64)dst.width * dst.height * sizeof(img::Pixel));
+    }
+
+    auto& header = stream.header;
+    if (!stream.has_header && !read_pam_header(stream, header))
+    {
+        return false;
+    }
+
+    stream.has_header = false;
+
+    auto size = (u64)header.width * header.height * header.depth;
+
+    // every frame has the size of the first one
+    if (header.width != dst.width || header.height != dst.height || size > stream.pixel_bytes.size())
+    {
+        return false;
+    }
+
+    return read_exact(stream, stream.pixel_bytes.data(), size) && img::pam::read_pixels(stream.pixel_bytes.data(), header, dst);
+}
+
+
+static u32 hash_play_field(img::ImageView const& frame)
+{
+    TRACE_SCOPE("hash");
+
+    auto view = img::sub_view(frame, play_field_rect(frame));
+
+    u32 crc = 0;
+    for (u32 y = 0; y < view.height; y++)
+    {
+        crc = hash::crc32c((u8*)img::row_begin(view, y), view.width * sizeof(img::Pixel), crc);
+    }
+
+    return crc;
+}
+
+
+// the last n frames, the current one included, show the same play field at the same screen
+static bool is_stable(FrameStream const& stream, u32 n)
+{
+    if (stream.n_frames < n)
+    {
+        return false;
+    }
+
+    auto const& last = stream.history[(stream.n_frames - 1) % STREAM_HISTORY];
+    if (!last.located)
+    {
+        return false;
+    }
+
+    for (u64 i = stream.n_frames - n; i < stream.n_frames - 1; i++)
+    {
+        auto const& sample = stream.history[i % STREAM_HISTORY];
+        if (!sample.located || sample.hash != last.hash ||
+            sample.screen.x != last.screen.x || sample.screen.y != last.screen.y)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// a copy of the frame goes to the processing thread like a decoded screenshot
+static void commit_frame(img::ImageView const& frame, ImageQueue& queue, ProcessControl& control)
+{
+    img::Image image;
+    if (!img::create_image(image, frame.width, frame.height))
+    {
+        return;
+    }
+
+    img::copy(img::sub_view(frame), img::sub_view(img::make_view(image)));
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue_image(queue, image);
+    }
+
+    metrics::add(state.metrics.stream_commits);
+
+    notify_images_ready(control);
+}
+
+
+/*  stream thread, frames are read into one preallocated image, scaled frames are sampled
+    down into a second one
+    the play field of every located frame is hashed, a frame is committed to the map when the
+    last stable_frames frames have the same hash and position, frames mid-scroll or mid-fade never are
+    a screen is not committed again while its play field is the same as the last one committed
+*/
+static void run_frame_stream(AppState& state)
+{
+    auto& stream = state.stream;
+
+    trace::set_thread_name("stream");
+
+    if (!start_frame_stream(stream, state.options))
+    {
+        stream.ended = true;
+        return;
+    }
+
+    auto src = img::make_view(stream.frame);
+    auto frame = stream.is_scaled ? img::make_view(stream.native) : src;
+
+    while (is_running())
+    {
+        if (!read_frame(stream, src))
+        {
+            break;
+        }
+
+        TRACE_TIMED_SCOPE("stream frame", state.stream_times);
+
+        metrics::add(state.metrics.stream_frames);
+
+        if (stream.is_scaled)
+        {
+            // the last offset found is kept while the HUD is not visible
+            find_crop_offset(src, stream.layout);
+            scale_to_native(src, stream.layout, frame);
+        }
+
+        auto& sample = stream.history[stream.n_frames % STREAM_HISTORY];
+        stream.n_frames++;
+
+        sample.located = locate_screen(frame, sample.screen);
+        sample.hash = sample.located ? hash_play_field(frame) : 0;
+
+        if (!is_stable(stream, state.options.stable_frames))
+        {
+            continue;
+        }
+
+        auto s = sample.screen.y * MAP_WIDTH + sample.screen.x;
+        if (stream.committed[s] && stream.committed_hash[s] == sample.hash)
+        {
+            continue;
+        }
+
+        commit_frame(frame, state.image_queue, state.control);
+
+        stream.committed[s] = true;
+        stream.committed_hash[s] = sample.hash;
+    }
+
+    stream.ended = true;
+}
+
+
+static void destroy_frame_stream(FrameStream& stream)
+{
+    close_stream(stream);
+
+    img::destroy_image(stream.frame);
+    img::destroy_image(stream.native);
+}
+
+
+/* video */
+
+static void read_video_region(VideoSource const& video, u64 frame, Rect2Du32 const& r, img::SubView const& dst)
+{
+    auto bytes = video.file.data + video.frame_offsets[frame];
+
+    if (video.is_y4m)
+    {
+        img::y4m::read_pixels(bytes, video.header, r, dst);
+        return;
+    }
+
+    // raw RGB
+    u64 stride = (u64)video.dim.x * 3;
+
+    for (u32 y = r.y_begin; y < r.y_end; y++)
+    {
+        auto s = bytes + stride * y + r.x_begin * 3;
+        auto d = img::row_begin(dst, y - r.y_begin);
+
+        for (u32 x = 0; x < r.x_end - r.x_begin; x++, s += 3)
+        {
+            d[x] = img::to_pixel(s[0], s[1], s[2]);
+        }
+    }
+}
+
+
+// maps the file and finds every frame, Y4M is detected from the header, otherwise raw RGB of options.stream_dim
+static bool open_video(VideoSource& video, RunOptions const& options)
+{
+    if (!mem::map_file(video.file, options.video_path.c_str()))
+    {
+        return false;
+    }
+
+    auto data = video.file.data;
+    auto size = video.file.size;
+
+    video.is_y4m = img::y4m::read_header(data, size, video.header);
+
+    if (video.is_y4m)
+    {
+        video.dim = { video.header.width, video.header.height };
+
+        u64 pos = video.header.size;
+        while (pos < size)
+        {
+            auto n = img::y4m::frame_header_size(data + pos, size - pos);
+            if (!n || pos + n + video.header.frame_size > size)
+            {
+                break;
+            }
+
+            video.frame_offsets.push_back(pos + n);
+            pos += n + video.header.frame_size;
+        }
+    }
+    else
+    {
+        video.dim = options.stream_dim;
+
+        u64 frame_size = (u64)video.dim.x * video.dim.y * 3;
+        for (u64 pos = 0; pos + frame_size <= size; pos += frame_size)
+        {
+            video.frame_offsets.push_back(pos);
+        }
+    }
+
+    return has_play_field(video.dim) && !video.frame_offsets.empty();
+}
+
+
+static void close_video(VideoSource& video)
+{
+    mem::unmap_file(video.file);
+    video.frame_offsets.clear();
+}
+
+
+/*  a run of frames at the same screen has ended
+    frames are only decoded here, from the end of the run back, the last one the same as the frame
+    before it is kept for the screen
+*/
+static void end_video_run(VideoSource const& video, VideoSegment& seg, Point2Du32 screen, u64 run_begin, u64 run_end)
+{
+    TRACE_SCOPE("video run");
+
+    auto full = img::make_rect(video.dim.x, video.dim.y);
+    auto first = run_end - std::min(run_end - run_begin, (u64)STREAM_HISTORY);
+
+    u32 next_hash = 0;
+
+    for (auto i = run_end; i-- > first;)
+    {
+        auto view = img::make_view(seg.frames[i & 1]);
+
+        read_video_region(video, i, full, img::sub_view(view));
+        metrics::add(state.metrics.video_decoded);
+
+        auto hash = hash_play_field(view);
+
+        if (i + 1 < run_end && hash == next_hash)
+        {
+            // decoded again once the segments are merged
+            seg.screen_frames[screen.y * MAP_WIDTH + screen.x] = i + 1;
+            return;
+        }
+
+        next_hash = hash;
+    }
+}
+
+
+// only the mini-map is read from frames until the screen changes
+static void scan_video_segment(VideoSource const& video, VideoSegment& seg)
+{
+    trace::set_thread_name("video");
+
+    auto mini_r = img::make_rect(VIDEO_LOCATE_WIDTH, VIDEO_LOCATE_HEIGHT);
+
+    if (!img::create_image(seg.mini_map, VIDEO_LOCATE_WIDTH, VIDEO_LOCATE_HEIGHT) ||
+        !img::create_image(seg.frames[0], video.dim.x, video.dim.y) ||
+        !img::create_image(seg.frames[1], video.dim.x, video.dim.y))
+    {
+        return;
+    }
+
+    auto mini_map = img::make_view(seg.mini_map);
+
+    bool run_located = false;
+    Point2Du32 run_screen{};
+    u64 run_begin = seg.frame_begin;
+
+    auto i = seg.frame_begin;
+    for (; i < seg.frame_end && is_running(); i++)
+    {
+        read_video_region(video, i, mini_r, img::sub_view(mini_map));
+        metrics::add(state.metrics.video_frames);
+
+        Point2Du32 screen{};
+        auto located = locate_screen(mini_map, screen);
+
+        if (located != run_located || screen.x != run_screen.x || screen.y != run_screen.y)
+        {
+            if (run_located)
+            {
+                end_video_run(video, seg, run_screen, run_begin, i);
+            }
+
+            run_begin = i;
+            run_located = located;
+            run_screen = screen;
+        }
+    }
+
+    if (run_located)
+    {
+        end_video_run(video, seg, run_screen, run_begin, i);
+    }
+}
+
+
+static void destroy_video_segment(VideoSegment& seg)
+{
+    img::destroy_image(seg.mini_map);
+    img::destroy_image(seg.frames[0]);
+    img::destroy_image(seg.frames[1]);
+}
+
+
+/*  video thread, the frames are split into one segment per thread
+    each segment keeps the index of the last stable frame of every screen it sees,
+    the highest index of all segments is decoded and goes to the map
+*/
+static void run_video(AppState& state)
+{
+    auto& video = state.video;
+
+    trace::set_thread_name("video");
+
+    if (!open_video(video, state.options))
+    {
+        video.ended = true;
+        return;
+    }
+
+    auto n_frames = (u64)video.frame_offsets.size();
+    auto n_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto n_segments = (u32)std::clamp(n_frames / VIDEO_MIN_SEGMENT_FRAMES, (u64)1, (u64)n_threads);
+
+    std::vector<VideoSegment> segments(n_segments);
+    for (u32 i = 0; i < n_segments; i++)
+    {
+        segments[i].frame_begin = n_frames * i / n_segments;
+        segments[i].frame_end = n_frames * (i + 1) / n_segments;
+    }
+
+    parallel_for(state.workers, n_segments, [&](u32 i) { scan_video_segment(video, segments[i]); });
+
+    for (auto& seg : segments)
+    {
+        destroy_video_segment(seg);
+    }
+
+    auto full = img::make_rect(video.dim.x, video.dim.y);
+
+    u32 n_screens = 0;
+
+    for (u32 s = 0; s < MAP_WIDTH * MAP_HEIGHT && is_running(); s++)
+    {
+        u64 last = 0;
+        for (auto& seg : segments)
+        {
+            last = std::max(last, seg.screen_frames[s]);
+        }
+
+        img::Image image;
+        if (!last || !img::create_image(image, video.dim.x, video.dim.y))
+        {
+            continue;
+        }
+
+        read_video_region(video, last, full, img::sub_view(img::make_view(image)));
+        metrics::add(state.metrics.video_decoded);
+
+        // the queue owns the image now
+        std::lock_guard<std::mutex> lock(state.image_queue.mutex);
+        queue_image(state.image_queue, image);
+        n_screens++;
+    }
+
+    metrics::add(state.metrics.video_screens, n_screens);
+
+    if (n_screens)
+    {
+        notify_images_ready(state.control);
+    }
+
+    video.ended = true;
+}
+
+
+static bool update_map(ImageQueue& queue, ScreenSamples& samples, img::ImageView const& map, ScreenFlags& updated, u32& n_images, u32& n_written)
+{
+    std::vector<img::Image> images;
+    std::vector<i64> queued_ns;
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        images.swap(queue.images);
+        queued_ns.swap(queue.queued_ns);
+        metrics::set(state.metrics.queue_depth, 0);
+    }
+
+    n_images = (u32)images.size();
+    n_written = 0;
+
+    if (trace::is_enabled())
+    {
+        auto now = trace::now_ns();
+        for (auto begin : queued_ns)
+        {
+            trace::record("queue", begin, now - begin);
+        }
+    }
+
+    bool update = false;
+    for (auto& image : images)
+    {
+        Point2Du32 screen{};
+        switch (write_map(samples, img::make_view(image), map, screen))
+        {
+        case MapWrite::Written:
+            updated[screen.y * MAP_WIDTH + screen.x] = true;
+            update = true;
+            n_written++;
+            metrics::add(state.metrics.screens_written);
+            metrics::set(state.metrics.palette_colors, samples.screens[screen.y * MAP_WIDTH + screen.x].palette.n_colors);
+            break;
+
+        case MapWrite::NotLocated:
+            metrics::add(state.metrics.screens_rejected);
+            break;
+
+        default:
+            metrics::add(state.metrics.screens_invalid);
+            break;
+        }
+
+        img::destroy_image(image);
+    }
+
+    return update;
+}
+
+
+static fs::path normal_path(fs::path const& path)
+{
+    std::error_code ec;
+    auto p = fs::absolute(path, ec);
+
+    return (ec ? path : p).lexically_normal();
+}
+
+
+// path is dir or anything under it, both normalized
+static bool is_within(fs::path const& path, fs::path const& dir)
+{
+    auto p = path.generic_string();
+    auto d = dir.generic_string();
+
+    while (!d.empty() && d.back() == '/')
+    {
+        d.pop_back();
+    }
+
+    return p.compare(0, d.size(), d) == 0 && (p.size() == d.size() || p[d.size()] == '/');
+}
+
+
+static bool is_excluded_path(DirectoryWatch const& watch, fs::path const& path)
+{
+    auto p = normal_path(path);
+
+    for (auto const& dir : watch.excluded)
+    {
+        if (is_within(p, dir))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*  adds the screenshots under dir that are not in the file index with status
+    called once the watch is open to index the existing files, for new subdirectories
+    and after a watcher overflow to queue the files whose events were lost
+    with status New, indexed files written since they were last indexed or decoded are queued again
+*/
+static u32 index_directory(DirectoryWatch const& watch, fs::path const& dir, ImageQueue& queue, FileStatus status)
+{
+    std::vector<fs::path> paths;
+    std::vector<fs::file_time_type> write_times;
+
+    auto const options = fs::directory_options::skip_permission_denied;
+    auto const end = fs::recursive_directory_iterator();
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, options, ec); !ec && it != end; it.increment(ec))
+    {
+        std::error_code entry_ec;
+
+        if (it->is_directory(entry_ec))
+        {
+            if (is_excluded_path(watch, it->path()))
+            {
+                it.disable_recursion_pending();
+            }
+
+            continue;
+        }
+
+        if (is_screenshot_file(it->path(), watch.image_ext) && it->is_regular_file(entry_ec))
+        {
+            auto write_time = it->last_write_time(entry_ec);
+            if (entry_ec)
+            {
+                // deleted since
+                continue;
+            }
+
+            paths.push_back(it->path());
+            write_times.push_back(write_time);
+        }
+    }
+
+    u32 n_added = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        for (u32 i = 0; i < paths.size(); i++)
+        {
+            auto const& path = paths[i];
+            auto write_time = write_times[i];
+
+            auto it = queue.files.find(path);
+            if (it != queue.files.end() && it->second.status != FileStatus::Deleted)
+            {
+                auto& entry = it->second;
+
+                // queued or waiting for a retry already, the decode reads the latest version
+                bool is_queued = entry.status == FileStatus::New || entry.status == FileStatus::Retry;
+
+                // rewritten in place and its event lost
+                bool is_rewritten = write_time > entry.indexed_time && write_time > entry.decoded_time;
+
+                entry.indexed_time = std::max(entry.indexed_time, write_time);
+
+                if (status != FileStatus::New || is_queued || !is_rewritten)
+                {
+                    continue;
+                }
+            }
+
+            if (status == FileStatus::New)
+            {
+                mark_new(queue, path);
+            }
+            else
+            {
+                queue.files[path].status = status;
+            }
+
+            queue.files[path].indexed_time = write_time;
+
+            n_added++;
+        }
+    }
+
+    if (n_added && status == FileStatus::New)
+    {
+        queue.cv.notify_one();
+    }
+
+    return n_added;
+}
+
+
+// called when watcher events for dir were lost
+static void rescan_directory(DirectoryWatch const& watch, fs::path const& dir, ImageQueue& queue)
+{
+    TRACE_SCOPE("rescan");
+
+    metrics::add(state.metrics.watch_overflows);
+
+    auto n_found = index_directory(watch, dir, queue, FileStatus::New);
+
+    metrics::add(state.metrics.files_rescanned, n_found);
+}
+
+
+#ifdef _WIN32
+
+
+static void close_watch_directory(DirectoryWatch& watch)
+{
+    for (auto& root : watch.handles)
+    {
+        if (root.handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(root.handle);
+        }
+
+        if (root.overlapped.hEvent)
+        {
+            CloseHandle(root.overlapped.hEvent);
+        }
+    }
+
+    watch.handles.clear();
+}
+
+
+static bool open_watch_handles(DirectoryWatch& watch)
+{
+    if (watch.roots.size() > MAXIMUM_WAIT_OBJECTS)
+    {
+        return false;
+    }
+
+    watch.handles.resize(watch.roots.size());
+
+    for (u32 i = 0; i < watch.roots.size(); i++)
+    {
+        auto& root = watch.handles[i];
+        root.dir = watch.roots[i];
+
+        root.handle = CreateFileW(
+            root.dir.wstring().c_str(),
+            FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+            NULL);
+
+        root.overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (root.handle == INVALID_HANDLE_VALUE || !root.overlapped.hEvent)
+        {
+            close_watch_directory(watch);
+            return false;
+        }
+
+        // the largest buffer allowed for network shares, room for hundreds of events
+        // the system keeps changes in a buffer of this size between calls
+        root.buffer.resize(WATCH_BUFFER_SIZE / sizeof(DWORD));
+    }
+
+    return true;
+}
+
+
+#else
+
+
+static bool add_watch(DirectoryWatch& watch, fs::path const& dir)
+{
+    auto wd = inotify_add_watch(watch.fd, dir.string().c_str(), WATCH_EVENTS);
+    if (wd < 0)
+    {
+        return false;
+    }
+
+    watch.dirs[wd] = dir;
+
+    return true;
+}
+
+
+// inotify is not recursive, every directory under dir gets its own watch
+static bool add_watch_tree(DirectoryWatch& watch, fs::path const& dir)
+{
+    if (!add_watch(watch, dir))
+    {
+        return false;
+    }
+
+    auto const options = fs::directory_options::skip_permission_denied;
+    auto const end = fs::recursive_directory_iterator();
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, options, ec); !ec && it != end; it.increment(ec))
+    {
+        std::error_code entry_ec;
+        if (!it->is_directory(entry_ec))
+        {
+            continue;
+        }
+
+        if (is_excluded_path(watch, it->path()))
+        {
+            it.disable_recursion_pending();
+            continue;
+        }
+
+        add_watch(watch, it->path());
+    }
+
+    return true;
+}
+
+
+static void close_watch_directory(DirectoryWatch& watch)
+{
+    if (watch.fd >= 0)
+    {
+        close(watch.fd);
+        watch.fd = -1;
+    }
+
+    watch.dirs.clear();
+}
+
+
+#endif
+
+
+static bool open_watch_directory(DirectoryWatch& watch, AppSettings const& settings)
+{
+    watch.image_ext = settings.screenshot_ext;
+
+    // the program's own output is not a screenshot
+    watch.excluded.clear();
+    watch.excluded.push_back(normal_path(settings.map_save_path.parent_path() / SCREEN_EXPORT_DIR_NAME));
+    if (!settings.tile_dir.empty())
+    {
+        watch.excluded.push_back(normal_path(settings.tile_dir));
+    }
+
+    watch.roots.clear();
+
+    for (auto const& dir : settings.watch_dirs)
+    {
+        if (!fs::exists(dir) || !fs::is_directory(dir))
+        {
+            sdl::display_error("Image directory could not be found");
+            return false;
+        }
+
+        // a root inside another one is already watched
+        auto root = normal_path(dir);
+        auto nested = [&](fs::path const& other) { return is_within(root, other) || is_within(other, root); };
+
+        auto it = std::find_if(watch.roots.begin(), watch.roots.end(), nested);
+        if (it == watch.roots.end())
+        {
+            watch.roots.push_back(root);
+        }
+        else if (is_within(*it, root))
+        {
+            *it = root;
+        }
+    }
+
+#ifdef _WIN32
+
+    return open_watch_handles(watch);
+
+#else
+
+    watch.fd = inotify_init1(IN_NONBLOCK);
+    if (watch.fd < 0)
+    {
+        return false;
+    }
+
+    for (auto const& root : watch.roots)
+    {
+        if (!add_watch_tree(watch, root))
+        {
+            close_watch_directory(watch);
+            return false;
+        }
+    }
+
+    return true;
+
+#endif
+}
+
+
+#ifdef _WIN32
+
+
+static void read_changes(WatchRoot& root)
+{
+    DWORD notify_filter = 
+        FILE_NOTIFY_CHANGE_FILE_NAME |
+        FILE_NOTIFY_CHANGE_DIR_NAME |
+        FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+    auto buffer_size = (DWORD)(root.buffer.size() * sizeof(DWORD));
+
+    // watch the directory tree
+    ReadDirectoryChangesW(root.handle, root.buffer.data(), buffer_size, TRUE, notify_filter, NULL, &root.overlapped, NULL);
+}
+
+
+static void monitor_image_directory(DirectoryWatch& watch, ImageQueue& queue)
+{
+    // https://gist.github.com/nickav/a57009d4fcc3b527ed0f5c9cf30618f8
+
+    trace::set_thread_name("watcher");
+
+    std::vector<HANDLE> events;
+
+    for (auto& root : watch.handles)
+    {
+        read_changes(root);
+        events.push_back(root.overlapped.hEvent);
+    }
+
+    // changes are only recorded from the first call, pick up files added since the directories were indexed
+    for (auto const& root : watch.handles)
+    {
+        index_directory(watch, root.dir, queue, FileStatus::New);
+    }
+
+    std::vector<fs::path> new_dirs;
+
+    while (is_running())
+    {
+        // blocks until there are changes in any of the directories
+        auto result = WaitForMultipleObjects((DWORD)events.size(), events.data(), FALSE, WAIT_TIMEOUT_MS);
+
+        // timeouts, WAIT_ABANDONED_0 and WAIT_FAILED are all past the last event
+        if (result >= WAIT_OBJECT_0 + events.size())
+        {
+            continue;
+        }
+
+        auto& root = watch.handles[result - WAIT_OBJECT_0];
+
+        DWORD bytes_transferred = 0;
+        auto ok = GetOverlappedResult(root.handle, &root.overlapped, &bytes_transferred, FALSE);
+
+        // ERROR_NOTIFY_ENUM_DIR or zero bytes, the changes did not fit in the buffer
+        bool overflow = !ok || !bytes_transferred;
+
+        new_dirs.clear();
+
+        if (!overflow)
+        {
+            FILE_NOTIFY_INFORMATION *event = (FILE_NOTIFY_INFORMATION*)root.buffer.data();
+
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            auto n_pending = queue.pending.size();
+
+            while (is_running())
+            {
+                // relative to the root, including subdirectories
+                std::wstring fileName(event->FileName, event->FileNameLength / sizeof(WCHAR));
+                auto path = root.dir / fs::path(fileName);
+                if (is_screenshot_file(path, watch.image_ext) && !is_excluded_path(watch, path))
+                {
+                    // there is no close event, the decode thread waits until the writer is done
+                    switch (event->Action) 
+                    {
+                    case FILE_ACTION_ADDED:
+                    case FILE_ACTION_MODIFIED:
+                    case FILE_ACTION_RENAMED_NEW_NAME: {
+                        mark_new(queue, path);
+                        } break;
+
+                    case FILE_ACTION_REMOVED:
+                    case FILE_ACTION_RENAMED_OLD_NAME: {
+                        mark_deleted(queue, path);
+                        } break;
+
+                        default: {
+                        //printf("Unknown action!\n");
+                        } break;
+                    }
+                }
+                else if (event->Action == FILE_ACTION_ADDED || event->Action == FILE_ACTION_RENAMED_NEW_NAME)
+                {
+                    // a directory moved in brings its files without events for them
+                    std::error_code ec;
+                    if (fs::is_directory(path, ec) && !is_excluded_path(watch, path))
+                    {
+                        new_dirs.push_back(path);
+                    }
+                }
+
+                // Are there more events to handle?
+                if (event->NextEntryOffset) 
+                {
+                    *((uint8_t**)&event) += event->NextEntryOffset;
+                } 
+                else 
+                {
+                    break;
+                }
+            }
+
+            bool notify = queue.pending.size() != n_pending;
+            lock.unlock();
+
+            if (notify)
+            {
+                queue.cv.notify_one();
+            }
+        }
+
+        TRACE_INSTANT("watcher event", bytes_transferred);
+
+        // Queue the next event before scanning so no change is missed
+        read_changes(root);
+
+        for (auto const& dir : new_dirs)
+        {
+            index_directory(watch, dir, queue, FileStatus::New);
+        }
+
+        if (overflow)
+        {
+            rescan_directory(watch, root.dir, queue);
+        }
+    }
+
+    for (auto& root : watch.handles)
+    {
+        CancelIo(root.handle);
+    }
+}
+
+#else
+
+
+static void monitor_image_directory(DirectoryWatch& watch, ImageQueue& queue)
+{
+    // room for hundreds of events, names are at most NAME_MAX
+    std::vector<u64> buffer(WATCH_BUFFER_SIZE / sizeof(u64));
+    auto data = (char*)buffer.data();
+
+    pollfd pfd{};
+    pfd.fd = watch.fd;
+    pfd.events = POLLIN;
+
+    trace::set_thread_name("watcher");
+
+    std::vector<fs::path> new_dirs;
+
+    while (is_running())
+    {
+        // blocks until there are changes in any of the directories
+        if (poll(&pfd, 1, WAIT_TIMEOUT_MS) <= 0)
+        {
+            continue;
+        }
+
+        bool overflow = false;
+        new_dirs.clear();
+
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        auto n_pending = queue.pending.size();
+
+        // drain everything queued by the kernel, the descriptor is non-blocking
+        ssize_t n_bytes = 0;
+        while ((n_bytes = read(watch.fd, data, buffer.size() * sizeof(u64))) > 0)
+        {
+            for (char* p = data; p < data + n_bytes; )
+            {
+                auto event = (inotify_event*)p;
+                p += sizeof(inotify_event) + event->len;
+
+                // the kernel queue was full, events are lost
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    overflow = true;
+                }
+
+                // the directory was deleted or moved away
+                if (event->mask & IN_IGNORED)
+                {
+                    watch.dirs.erase(event->wd);
+                    continue;
+                }
+
+                auto dir = watch.dirs.find(event->wd);
+                if (!event->len || dir == watch.dirs.end())
+                {
+                    continue;
+                }
+
+                auto path = dir->second / event->name;
+
+                if (event->mask & IN_ISDIR)
+                {
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !is_excluded_path(watch, path))
+                    {
+                        new_dirs.push_back(path);
+                    }
+
+                    continue;
+                }
+
+                if (!is_screenshot_file(path, watch.image_ext))
+                {
+                    continue;
+                }
+
+                // complete once the writer closes it or it is renamed into place
+                if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                {
+                    mark_new(queue, path);
+                }
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    mark_deleted(queue, path);
+                }
+            }
+
+            TRACE_INSTANT("watcher event", n_bytes);
+        }
+
+        bool notify = queue.pending.size() != n_pending;
+        lock.unlock();
+
+        if (notify)
+        {
+            queue.cv.notify_one();
+        }
+
+        // files written before the watch was added have no events
+        for (auto const& dir : new_dirs)
+        {
+            add_watch_tree(watch, dir);
+            index_directory(watch, dir, queue, FileStatus::New);
+        }
+
+        if (overflow)
+        {
+            // events for new directories may be lost too
+            for (auto const& root : watch.roots)
+            {
+                add_watch_tree(watch, root);
+                rescan_directory(watch, root, queue);
+            }
+        }
+    }
+}
+
+#endif
+
+
+static Rect2Du32 to_screen_range(Rect2Du32 const& map_rect, img::ImageView const& map, Vec2Du32 screen_dim)
+{
+    // pixels of neighboring screens are blended in by the resize filter
+    constexpr f32 pad = 3.0f;
+
+    auto width = (f32)screen_dim.x;
+    auto height = (f32)screen_dim.y;
+
+    auto scale_x = width / map.width;
+    auto scale_y = height / map.height;
+
+    Rect2Du32 r{};
+    r.x_begin = (u32)std::max(0.0f, std::floor(map_rect.x_begin * scale_x) - pad);
+    r.x_end = (u32)std::min(width, std::ceil(map_rect.x_end * scale_x) + pad);
+    r.y_begin = (u32)std::max(0.0f, std::floor(map_rect.y_begin * scale_y) - pad);
+    r.y_end = (u32)std::min(height, std::ceil(map_rect.y_end * scale_y) + pad);
+
+    return r;
+}
+
+
+static void invalidate_pyramid(mip::Pyramid& pyramid, ScreenFlags const& updated)
+{
+    for (u32 s = 0; s < updated.size(); s++)
+    {
+        if (updated[s])
+        {
+            mip::invalidate(pyramid, screen_rect(s % MAP_WIDTH, s / MAP_WIDTH));
+        }
+    }
+}
+
+
+// full resize split into horizontal bands on all cores
+static void render_map_bands(img::ImageView const& map, img::ImageView const& dst)
+{
+    auto n_bands = (dst.height + SCREEN_BAND_HEIGHT - 1) / SCREEN_BAND_HEIGHT;
+
+    parallel_for(state.workers, n_bands, [&](u32 i)
+    {
+        auto y_begin = i * SCREEN_BAND_HEIGHT;
+        auto y_end = std::min(y_begin + SCREEN_BAND_HEIGHT, dst.height);
+
+        Rect2Du32 r{};
+        r.x_begin = 0;
+        r.x_end = dst.width;
+        r.y_begin = y_begin;
+        r.y_end = y_end;
+
+        img::resize(map, dst, r);
+    });
+}
+
+
+static ScreenCacheEntry* find_screen_image(ScreenCache& cache, img::ImageView const& map, Vec2Du32 dim)
+{
+    ScreenCacheEntry* entry = nullptr;
+
+    for (auto& e : cache.entries)
+    {
+        if (e.image.data_ && e.image.width == dim.x && e.image.height == dim.y)
+        {
+            entry = &e;
+            break;
+        }
+    }
+
+    if (entry)
+    {
+        // only what changed while the entry was not shown
+        auto view = img::make_view(entry->image);
+
+        for (u32 s = 0; s < entry->stale.size(); s++)
+        {
+            if (entry->stale[s])
+            {
+                img::resize(map, view, to_screen_range(screen_rect(s % MAP_WIDTH, s / MAP_WIDTH), map, dim));
+            }
+        }
+    }
+    else
+    {
+        // replace the least recently used
+        entry = &cache.entries[0];
+        for (auto& e : cache.entries)
+        {
+            if (e.last_used < entry->last_used)
+            {
+                entry = &e;
+            }
+        }
+
+        img::destroy_image(entry->image);
+        if (!img::create_image(entry->image, dim.x, dim.y))
+        {
+            entry->last_used = 0;
+            return nullptr;
+        }
+
+        render_map_bands(map, img::make_view(entry->image));
+    }
+
+    entry->stale = {};
+    entry->last_used = ++cache.use_count;
+
+    return entry;
+}
+
+
+/* frames */
+
+static void add_rect(RectList& list, Rect2Du32 const& rect)
+{
+    if (list.all || rect.x_begin >= rect.x_end || rect.y_begin >= rect.y_end)
+    {
+        return;
+    }
+
+    if (list.count == MAX_FRAME_RECTS)
+    {
+        list.all = true;
+        return;
+    }
+
+    list.rects[list.count++] = rect;
+}
+
+
+static void add_rects(RectList& list, RectList const& src)
+{
+    list.all = list.all || src.all;
+
+    for (u32 i = 0; i < src.count; i++)
+    {
+        add_rect(list, src.rects[i]);
+    }
+}
+
+
+static void add_screen_rects(RectList& list, ScreenFlags const& updated, img::ImageView const& map, Vec2Du32 screen_dim)
+{
+    for (u32 s = 0; s < updated.size(); s++)
+    {
+        if (updated[s])
+        {
+            add_rect(list, to_screen_range(screen_rect(s % MAP_WIDTH, s / MAP_WIDTH), map, screen_dim));
+        }
+    }
+}
+
+
+static void destroy_frames(FrameHandoff& handoff)
+{
+    for (auto& frame : handoff.frames)
+    {
+        img::destroy_image(frame.image);
+    }
+}
+
+
+// processing thread, makes the back frame the newest one
+static void publish_frame(FrameHandoff& handoff)
+{
+    auto& frame = handoff.frames[handoff.back];
+    frame.id = handoff.next_id++;
+
+    for (u32 i = 0; i < handoff.frames.size(); i++)
+    {
+        if (i != handoff.back)
+        {
+            add_rects(handoff.frames[i].pending, frame.changed);
+        }
+    }
+
+    handoff.back = handoff.middle.exchange(handoff.back | FRAME_FRESH) & ~FRAME_FRESH;
+}
+
+
+// render thread, nullptr when nothing new was published
+static ScreenFrame* take_frame(FrameHandoff& handoff)
+{
+    if (!(handoff.middle.load() & FRAME_FRESH))
+    {
+        return nullptr;
+    }
+
+    handoff.front = handoff.middle.exchange(handoff.front) & ~FRAME_FRESH;
+
+    return &handoff.frames[handoff.front];
+}
+
+
+static Vec2Du32 map_dim()
+{
+    return { MAP_WIDTH * GAME_SCREEN_WIDTH, MAP_HEIGHT * GAME_SCREEN_HEIGHT };
+}
+
+
+static bool is_zoomed(Camera const& camera)
+{
+    return camera.zoom > 0.0f;
+}
+
+
+static f32 fit_zoom(Vec2Du32 map_dim, Vec2Du32 view_dim)
+{
+    return std::min((f32)view_dim.x / map_dim.x, (f32)view_dim.y / map_dim.y);
+}
+
+
+static void clamp_camera(Camera& camera, Vec2Du32 map_dim, Vec2Du32 view_dim)
+{
+    auto const clamp_axis = [](f32 pos, f32 view_size, f32 map_size)
+    {
+        if (view_size >= map_size)
+        {
+            // centered
+            return (map_size - view_size) / 2.0f;
+        }
+
+        return std::clamp(pos, 0.0f, map_size - view_size);
+    };
+
+    camera.x = clamp_axis(camera.x, view_dim.x / camera.zoom, (f32)map_dim.x);
+    camera.y = clamp_axis(camera.y, view_dim.y / camera.zoom, (f32)map_dim.y);
+}
+
+
+// keeps the map position under the cursor in place
+static void zoom_camera(Camera& camera, Vec2Du32 map_dim, Vec2Du32 view_dim, int wheel)
+{
+    if (!wheel || !view_dim.x || !view_dim.y)
+    {
+        return;
+    }
+
+    int mouse_x = 0;
+    int mouse_y = 0;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    Point2Df32 cursor{};
+    cursor.x = (f32)mouse_x;
+    cursor.y = (f32)mouse_y;
+
+    // map position under the cursor
+    Point2Df32 pos{};
+    if (is_zoomed(camera))
+    {
+        pos.x = camera.x + cursor.x / camera.zoom;
+        pos.y = camera.y + cursor.y / camera.zoom;
+    }
+    else
+    {
+        pos.x = cursor.x * map_dim.x / view_dim.x;
+        pos.y = cursor.y * map_dim.y / view_dim.y;
+    }
+
+    auto const fit = fit_zoom(map_dim, view_dim);
+
+    auto zoom = is_zoomed(camera) ? camera.zoom : fit;
+    zoom *= std::pow(ZOOM_STEP, (f32)wheel);
+
+    if (zoom <= fit)
+    {
+        // back to the whole map
+        camera.zoom = 0.0f;
+        camera.dragging = false;
+        camera.changed = true;
+        return;
+    }
+
+    camera.zoom = std::min(zoom, MAX_ZOOM);
+    camera.x = pos.x - cursor.x / camera.zoom;
+    camera.y = pos.y - cursor.y / camera.zoom;
+
+    clamp_camera(camera, map_dim, view_dim);
+
+    camera.changed = true;
+}
+
+
+static void pan_camera(Camera& camera, Vec2Du32 map_dim, Vec2Du32 view_dim, int dx, int dy)
+{
+    if (!is_zoomed(camera) || !camera.dragging)
+    {
+        return;
+    }
+
+    camera.x -= dx / camera.zoom;
+    camera.y -= dy / camera.zoom;
+
+    clamp_camera(camera, map_dim, view_dim);
+
+    camera.changed = true;
+}
+
+
+// processing thread, renders the back frame and publishes it
+static void render_frame(AppState& state, Camera camera, Vec2Du32 screen_dim, RectList const& changes)
+{
+    TRACE_SCOPE("resize");
+
+    auto& handoff = state.frames;
+    auto& frame = handoff.frames[handoff.back];
+    auto const& map = state.map_view;
+
+    if (frame.image.width != screen_dim.x || frame.image.height != screen_dim.y)
+    {
+        img::destroy_image(frame.image);
+        if (!img::create_image(frame.image, screen_dim.x, screen_dim.y))
+        {
+            return;
+        }
+
+        frame.pending.all = true;
+    }
+
+    auto view = img::make_view(frame.image);
+
+    // this buffer is behind by the frames published since it was last rendered
+    auto todo = frame.pending;
+    add_rects(todo, changes);
+
+    if (is_zoomed(camera))
+    {
+        // cost depends on the window size, not the map size
+        clamp_camera(camera, map_dim(), screen_dim);
+
+        mip::render_view(state.map_pyramid, camera.x, camera.y, camera.zoom, img::sub_view(view));
+    }
+    else if (todo.all)
+    {
+        auto entry = find_screen_image(state.screen_cache, map, screen_dim);
+        if (entry)
+        {
+            img::copy(img::sub_view(img::make_view(entry->image)), img::sub_view(view));
+        }
+        else
+        {
+            render_map_bands(map, view);
+        }
+    }
+    else
+    {
+        for (u32 i = 0; i < todo.count; i++)
+        {
+            img::resize(map, view, todo.rects[i]);
+        }
+    }
+
+    frame.changed = changes;
+    frame.pending = {};
+
+    publish_frame(handoff);
+
+    sdl::push_user_event(state.frame_event_type);
+}
+
+
+static void upload_rect(sdl::ScreenMemory& screen, img::ImageView const& view, Rect2Du32 const& rect)
+{
+    img::SubView dst{};
+    if (!sdl::lock_screen(screen, rect, dst))
+    {
+        return;
+    }
+
+    img::copy(img::sub_view(view, rect), dst);
+
+    sdl::unlock_screen(screen);
+}
+
+
+// render thread, uploads the newest frame if there is one
+static void show_frame(FrameHandoff& handoff, sdl::ScreenMemory& screen)
+{
+    auto frame = take_frame(handoff);
+    if (!frame || !frame->image.data_)
+    {
+        return;
+    }
+
+    auto view = img::make_view(frame->image);
+
+    // a skipped frame's changes are not in this frame's list
+    auto full = frame->changed.all || frame->id != handoff.shown_id + 1;
+
+    if (view.width != screen.texture_width || view.height != screen.texture_height)
+    {
+        if (!sdl::resize_screen_texture(screen, { view.width, view.height }))
+        {
+            sdl::print_message("Could not resize screen texture");
+            end_program();
+            return;
+        }
+
+        full = true;
+    }
+
+    TRACE_SCOPE_ARG("texture upload", full ? 0 : frame->changed.count);
+
+    if (full)
+    {
+        upload_rect(screen, view, img::make_rect(view.width, view.height));
+    }
+    else
+    {
+        for (u32 i = 0; i < frame->changed.count; i++)
+        {
+            upload_rect(screen, view, frame->changed.rects[i]);
+        }
+    }
+
+    handoff.shown_id = frame->id;
+}
+
+
+// render thread, hands the window size and camera to the processing thread
+static void send_view(AppState& state)
+{
+    Vec2Du32 dim = { state.screen.window_width, state.screen.window_height };
+    if (!dim.x || !dim.y)
+    {
+        return;
+    }
+
+    auto resized = dim.x != state.view_dim.x || dim.y != state.view_dim.y;
+    if (!resized && !state.camera.changed)
+    {
+        return;
+    }
+
+    if (is_zoomed(state.camera))
+    {
+        clamp_camera(state.camera, map_dim(), dim);
+    }
 
-        if (!image.read(full_path))
-        {
-            continue;
-        }
+    auto& control = state.control;
 
-        update |= write_map(image.view(), map);
+    {
+        std::lock_guard<std::mutex> lock(control.mutex);
+        control.camera = state.camera;
+        control.screen_dim = dim;
+        control.view_changed = true;
     }
 
-    return update;
+    control.cv.notify_one();
+
+    state.view_dim = dim;
+    state.camera.changed = false;
 }
 
 
-static bool open_watch_directory(AppState& state)
+static void request_save(ProcessControl& control, bool& request)
 {
-    if (!fs::exists(state.settings.watch_dir) || !fs::is_directory(state.settings.watch_dir))
     {
-        sdl::display_error("Image directory could not be found");
-        return false;
+        std::lock_guard<std::mutex> lock(control.mutex);
+        request = true;
     }
 
-    auto dir_w = state.settings.watch_dir.wstring();
+    control.cv.notify_one();
+}
 
-    state.h_watch_dir = CreateFileW(
-        dir_w.c_str(),
-        FILE_LIST_DIRECTORY,
-        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-        NULL,
-        OPEN_EXISTING,
-        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
-        NULL);
 
-    if (state.h_watch_dir == INVALID_HANDLE_VALUE) 
-    {            
-        return false;
-    }
+static void save_map()
+{
+    TRACE_TIMED_SCOPE("save map", state.save_times);
 
-    return true;
+    state.map_image.write(state.settings.map_save_path);
 }
 
 
-static void monitor_image_directory(HANDLE dir, FileList& image_list)
+static void save_screens()
 {
-    // https://gist.github.com/nickav/a57009d4fcc3b527ed0f5c9cf30618f8
+    auto dir = state.settings.map_save_path.parent_path() / SCREEN_EXPORT_DIR_NAME;
 
-    char buffer[1024] = { 0 };
-    DWORD bytesReturned = 0;
+    export_screens(state.screen_export, state.workers, dir, state.map_view);
+}
 
-    OVERLAPPED overlapped = {0};
-    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
-    auto success = ReadDirectoryChangesW(
-        dir,                // handle to directory
-        &buffer,             // buffer to store results
-        sizeof(buffer),      // size of buffer
-        FALSE,                // watch the directory tree
-        FILE_NOTIFY_CHANGE_FILE_NAME |
-        FILE_NOTIFY_CHANGE_DIR_NAME |
-        FILE_NOTIFY_CHANGE_ATTRIBUTES |
-        FILE_NOTIFY_CHANGE_SIZE |
-        FILE_NOTIFY_CHANGE_LAST_WRITE |
-        FILE_NOTIFY_CHANGE_CREATION,
-        &bytesReturned,      // bytes returned
-        &overlapped,                // overlapped structure
-        NULL);
+static void set_window_icon(sdl::ScreenMemory const& screen)
+{
+#include "../res/icon_64.c"
+    sdl::set_window_icon(screen.window, icon_64);
+}
 
-    while (is_running())
-    {
-        auto result = WaitForSingleObject(overlapped.hEvent, 0);
 
-        if (result == WAIT_OBJECT_0) 
-        {
-            DWORD bytes_transferred;
-            GetOverlappedResult(dir, &overlapped, &bytes_transferred, FALSE);
+static void register_metrics(AppMetrics& m)
+{
+    m.files_seen = metrics::add_counter("files_seen");
+    m.watch_overflows = metrics::add_counter("watch_overflows");
+    m.files_rescanned = metrics::add_counter("files_rescanned");
+    m.images_decoded = metrics::add_counter("images_decoded");
+    m.read_retries = metrics::add_counter("read_retries");
+    m.decode_failed = metrics::add_counter("decode_failed");
+    m.bytes_decoded = metrics::add_counter("bytes_decoded");
+    m.screens_written = metrics::add_counter("screens_written");
+    m.screens_rejected = metrics::add_counter("screens_rejected");
+    m.screens_invalid = metrics::add_counter("screens_invalid");
+    m.stream_frames = metrics::add_counter("stream_frames");
+    m.stream_commits = metrics::add_counter("stream_commits");
+    m.video_frames = metrics::add_counter("video_frames");
+    m.video_decoded = metrics::add_counter("video_decoded");
+    m.video_screens = metrics::add_counter("video_screens");
+
+    m.queue_depth = metrics::add_gauge("queue_depth");
+    m.palette_colors = metrics::add_gauge("palette_colors");
+}
 
-            FILE_NOTIFY_INFORMATION *event = (FILE_NOTIFY_INFORMATION*)buffer;            
 
-            while (is_running())
-            {
-                std::wstring fileName(event->FileName, event->FileNameLength / sizeof(WCHAR));
-                auto path = fs::path(fileName);
-                if (path.extension() == ".png")
-                {
-                    switch (event->Action) 
-                    {
-                    case FILE_ACTION_ADDED: {
-                        image_list[path] = FileStatus::New;
-                        } break;
+// ,"<name>_count":n,"<name>_mean_ms":... for a histogram of ns
+static void write_times_json(FILE* out, cstr name, timing::Histogram const& hist)
+{
+    constexpr f64 ms = 1'000'000.0;
+
+    fprintf(out, ",\"%s_count\":%llu,\"%s_mean_ms\":%.3f,\"%s_p50_ms\":%.3f,\"%s_p99_ms\":%.3f,\"%s_max_ms\":%.3f",
+        name, (unsigned long long)timing::count(hist),
+        name, timing::mean(hist) / ms,
+        name, timing::percentile(hist, 0.5) / ms,
+        name, timing::percentile(hist, 0.99) / ms,
+        name, timing::max_value(hist) / ms);
+}
 
-                    case FILE_ACTION_REMOVED: {
-                        image_list[path] = FileStatus::Deleted;
-                        } break;
 
-                        /*case FILE_ACTION_MODIFIED: {
-                            wprintf(L"    Modified: %.*s\n", name_len, event->FileName);
-                        } break;
+// one JSON object per line, frame times are from the render thread
+static void write_stats_line(FILE* out)
+{
+    std::chrono::duration<f64> elapsed = pacing::Clock::now() - state.start_time;
 
-                        case FILE_ACTION_RENAMED_OLD_NAME: {
-                        wprintf(L"Renamed from: %.*s\n", name_len, event->FileName);
-                        } break;
+    // decoded pixel bytes per ns * 1000 = MB/s
+    auto decode_ns = state.decode_times.total.load();
+    auto decode_mb_s = decode_ns ? 1000.0 * metrics::read(state.metrics.bytes_decoded) / decode_ns : 0.0;
 
-                        case FILE_ACTION_RENAMED_NEW_NAME: {
-                        wprintf(L"          to: %.*s\n", name_len, event->FileName);
-                        } break;*/
+    fprintf(out, "{\"time_s\":%.3f,", elapsed.count());
 
-                        default: {
-                        //printf("Unknown action!\n");
-                        } break;
-                    }
-                }
+    metrics::write_json_fields(out);
 
-                // Are there more events to handle?
-                if (event->NextEntryOffset) 
-                {
-                    *((uint8_t**)&event) += event->NextEntryOffset;
-                } 
-                else 
-                {
-                    break;
-                }
-            }
-            
-            // Queue the next event
-            success = ReadDirectoryChangesW(
-                dir, &buffer, sizeof(buffer), TRUE,
-                FILE_NOTIFY_CHANGE_FILE_NAME  |
-                FILE_NOTIFY_CHANGE_DIR_NAME   |
-                FILE_NOTIFY_CHANGE_LAST_WRITE,
-                NULL, &overlapped, NULL);
+    fprintf(out, ",\"decode_mb_s\":%.1f", decode_mb_s);
 
-        }
+    write_times_json(out, "decode", state.decode_times);
+    write_times_json(out, "save", state.save_times);
+    write_times_json(out, "stream", state.stream_times);
+    write_times_json(out, "frame", state.pacer.histogram);
 
-        // reduce CPU usage
-        std::this_thread::sleep_for(std::chrono::milliseconds((i64)(200)));
-    }
+    fprintf(out, "}\n");
+
+    fflush(out);
 }
 
 
-static void save_map()
+static void save_stats()
 {
-    state.map_image.write(state.settings.map_save_path);
+    auto path = state.settings.map_save_path.parent_path() / STATS_FILE_NAME;
+
+    auto out = fopen(path.string().c_str(), "a");
+    if (!out)
+    {
+        return;
+    }
+
+    write_stats_line(out);
+
+    fclose(out);
 }
 
 
-static void set_window_icon(sdl::ScreenMemory const& screen)
+// render thread, headless runs write to stdout
+static void update_stats()
 {
-#include "../res/icon_64.c"
-    sdl::set_window_icon(screen.window, icon_64);
+    auto interval = state.settings.stats_interval_sec;
+    if (!interval)
+    {
+        return;
+    }
+
+    auto now = pacing::Clock::now();
+    if (now < state.next_stats_time)
+    {
+        return;
+    }
+
+    state.next_stats_time = now + std::chrono::seconds(interval);
+
+    if (state.options.headless)
+    {
+        write_stats_line(stdout);
+    }
+    else
+    {
+        save_stats();
+    }
 }
 
 
-static void cap_framerate(Stopwatch& sw, f64 target_ns)
+static void save_trace()
 {
-    constexpr f64 fudge = 0.9;
-
-    auto sleep_ns = target_ns - sw.get_time_nano();
-    if (sleep_ns > 0)
+    if (!trace::is_enabled())
     {
-        std::this_thread::sleep_for(std::chrono::nanoseconds((i64)(sleep_ns * fudge)));
+        return;
     }
 
-    sw.start();
+    auto path = state.settings.map_save_path.parent_path() / TRACE_FILE_NAME;
+
+    trace::write_chrome_json(path.string().c_str());
+
+    if (trace::dropped_threads())
+    {
+        fprintf(stderr, "trace: %u threads not recorded\n", trace::dropped_threads());
+    }
 }
 
 
@@ -447,7 +4527,26 @@ static void handle_sdl_event(SDL_Event const& event, SDL_Window* window)
     switch(event.type)
     {
     case SDL_WINDOWEVENT:
-        sdl::handle_window_event(event.window);
+        if (sdl::handle_window_event(state.screen, event.window))
+        {
+            state.screen.redraw = true;
+        }
+        break;
+
+    case SDL_MOUSEWHEEL:
+        zoom_camera(state.camera, map_dim(), state.view_dim, event.wheel.y);
+        break;
+
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        if (event.button.button == SDL_BUTTON_LEFT)
+        {
+            state.camera.dragging = event.type == SDL_MOUSEBUTTONDOWN;
+        }
+        break;
+
+    case SDL_MOUSEMOTION:
+        pan_camera(state.camera, map_dim(), state.view_dim, event.motion.xrel, event.motion.yrel);
         break;
 
     case SDL_QUIT:
@@ -484,7 +4583,11 @@ static void handle_sdl_event(SDL_Event const& event, SDL_Window* window)
         switch (key_code)
         {
         case SDLK_s:
-            save_map();
+            request_save(state.control, state.control.save_map);
+            break;
+
+        case SDLK_e:
+            request_save(state.control, state.control.save_screens);
             break;
 
 #ifndef NDEBUG
@@ -498,6 +4601,24 @@ static void handle_sdl_event(SDL_Event const& event, SDL_Window* window)
             break;
         } 
 
+        // files written once per press, not on release or key repeat
+        if (event.type == SDL_KEYDOWN && !event.key.repeat)
+        {
+            switch (key_code)
+            {
+            case SDLK_f:
+                save_stats();
+                break;
+
+            case SDLK_t:
+                save_trace();
+                break;
+
+            default:
+                break;
+            }
+        }
+
     } break;
         
     }
@@ -507,22 +4628,53 @@ static void handle_sdl_event(SDL_Event const& event, SDL_Window* window)
 static void process_user_input()
 {
     SDL_Event event;
-    
-    while (SDL_PollEvent(&event))
+
+    // sleep until there is input or a frame was published
+    auto timeout = state.options.headless ? 0 : (int)WAIT_TIMEOUT_MS;
+
+    if (!SDL_WaitEventTimeout(&event, timeout))
+    {
+        return;
+    }
+
+    do
     {
         handle_sdl_event(event, state.screen.window);
+
+    } while (SDL_PollEvent(&event));
+}
+
+
+static fs::path find_map_file(fs::path const& map_save_path)
+{
+    if (fs::exists(map_save_path))
+    {
+        return map_save_path;
+    }
+
+    // map saved before MAP_FORMAT was changed
+    for (auto f : IMAGE_FORMATS)
+    {
+        auto path = map_file_path(map_save_path.parent_path(), to_image_extension(f));
+        if (fs::exists(path))
+        {
+            return path;
+        }
     }
+
+    return fs::path();
 }
 
 
 static bool load_map()
 {
-    if (!fs::exists(state.settings.map_save_path))
+    auto map_path = find_map_file(state.settings.map_save_path);
+    if (map_path.empty())
     {
         return false;
     }
 
-    if (!state.map_image.read(state.settings.map_save_path))
+    if (!state.map_image.read(map_path))
     {
         return false;
     }
@@ -546,12 +4698,33 @@ static bool main_init()
 {
     state.settings = load_app_settings();
 
-    if (!open_watch_directory(state))
+    if (state.options.stats_interval_sec)
+    {
+        state.settings.stats_interval_sec = state.options.stats_interval_sec;
+    }
+
+    register_metrics(state.metrics);
+
+    trace::enable(state.options.trace);
+    trace::set_thread_name("render");
+
+    if (state.options.headless && !sdl::init_headless())
+    {
+        return false;
+    }
+
+    if (!open_watch_directory(state.watch, state.settings))
     {
         sdl::display_error("Could not open screenshot directory");
         return false;
     }
 
+    // screenshots already there are not added to the map
+    for (auto const& root : state.watch.roots)
+    {
+        index_directory(state.watch, root, state.image_queue, FileStatus::Existing);
+    }
+
     auto map_w = MAP_WIDTH * GAME_SCREEN_WIDTH;
     auto map_h = MAP_HEIGHT * GAME_SCREEN_HEIGHT;
 
@@ -567,6 +4740,8 @@ static bool main_init()
         img::fill(state.map_view, img::to_pixel(0));
     }
 
+    state.frame_event_type = sdl::register_user_event();
+
     auto screen_w = (u32)(map_w * SCREEN_SCALE + 0.5f);
     auto screen_h = (u32)(map_h * SCREEN_SCALE + 0.5f);
 
@@ -577,7 +4752,29 @@ static bool main_init()
     }
 
     set_window_icon(state.screen);
-    img::resize(state.map_view, state.screen.view);
+
+    if (!mip::create(state.map_pyramid, state.map_view, TILE_SIZE))
+    {
+        sdl::display_error("Could not create map pyramid");
+        return false;
+    }
+
+    // first frame before the processing thread starts
+    state.view_dim = { state.screen.window_width, state.screen.window_height };
+    state.control.screen_dim = state.view_dim;
+
+    RectList all{};
+    all.all = true;
+
+    render_frame(state, state.camera, state.view_dim, all);
+    show_frame(state.frames, state.screen);
+
+    start_worker_pool(state.workers);
+
+    if (!state.settings.tile_dir.empty() && !start_tile_export(state.tile_export, state.settings.tile_dir, state.map_view))
+    {
+        sdl::display_error("Could not start tile export");
+    }
 
     return true;
 }
@@ -585,9 +4782,151 @@ static bool main_init()
 
 static void main_close()
 {
-    save_map();
-    CloseHandle(state.h_watch_dir);
+    // headless runs leave no files behind
+    if (!state.options.headless)
+    {
+        save_map();
+        save_stats();
+    }
+
+    save_trace();
+
+    stop_tile_export(state.tile_export);
+    stop_worker_pool(state.workers);
+    close_watch_directory(state.watch);
+    destroy_frame_stream(state.stream);
+    close_video(state.video);
     sdl::destroy_screen_memory(state.screen);
+    destroy_screen_cache(state.screen_cache);
+    destroy_frames(state.frames);
+    mip::destroy(state.map_pyramid);
+}
+
+
+static bool is_headless_done(AppState const& state)
+{
+    auto const& options = state.options;
+
+    if (options.max_frames && state.pacer.n_frames >= options.max_frames)
+    {
+        return true;
+    }
+
+    // the frame with the last screenshot has been taken and presented
+    auto frame_pending = state.frames.middle.load() & FRAME_FRESH;
+
+    auto streaming = !options.stream_path.empty();
+    auto has_video = !options.video_path.empty();
+
+    if (streaming || has_video)
+    {
+        auto const& m = state.metrics;
+
+        // every committed frame has been added to the map
+        auto n_images = metrics::read(m.images_decoded) + metrics::read(m.stream_commits) + metrics::read(m.video_screens);
+
+        auto ended = (!streaming || state.stream.ended) && (!has_video || state.video.ended);
+
+        return ended && state.n_files_processed >= n_images && !frame_pending;
+    }
+
+    return options.max_files && state.n_files_shown >= options.max_files && !frame_pending;
+}
+
+
+static void print_headless_timing(AppState const& state, f64 elapsed_sec)
+{
+    auto n_frames = state.pacer.n_frames;
+
+    printf("headless files: %u frames: %llu elapsed: %.3f s fps: %.1f\n",
+        state.n_files_shown.load(),
+        (unsigned long long)n_frames,
+        elapsed_sec,
+        elapsed_sec > 0.0 ? n_frames / elapsed_sec : 0.0);
+
+    pacing::print_stats(state.pacer.histogram, stdout);
+
+    write_stats_line(stdout);
+}
+
+
+// processing thread, the map, its pyramid and the screen images are only touched here
+static void process_map(AppState& state)
+{
+    auto& control = state.control;
+
+    Camera camera{};
+    Vec2Du32 screen_dim{};
+
+    trace::set_thread_name("processing");
+
+    while (is_running())
+    {
+        bool view_changed = false;
+        bool save_map_requested = false;
+        bool save_screens_requested = false;
+
+        {
+            std::unique_lock<std::mutex> lock(control.mutex);
+            control.cv.wait_for(lock, std::chrono::milliseconds(WAIT_TIMEOUT_MS), [&]()
+            {
+                return control.view_changed || control.save_map || control.save_screens || control.images_ready || !is_running();
+            });
+
+            view_changed = control.view_changed;
+            save_map_requested = control.save_map;
+            save_screens_requested = control.save_screens;
+
+            camera = control.camera;
+            screen_dim = control.screen_dim;
+
+            control.view_changed = false;
+            control.save_map = false;
+            control.save_screens = false;
+            control.images_ready = false;
+        }
+
+        RectList changes{};
+        changes.all = view_changed;
+
+        ScreenFlags updated{};
+        u32 n_images = 0;
+        u32 n_written = 0;
+        if (update_map(state.image_queue, state.screen_samples, state.map_view, updated, n_images, n_written))
+        {
+            invalidate_screen_cache(state.screen_cache, updated);
+            invalidate_pyramid(state.map_pyramid, updated);
+
+            post_screens(state.tile_export, state.map_view, updated);
+
+            if (is_zoomed(camera))
+            {
+                changes.all = true;
+            }
+            else
+            {
+                add_screen_rects(changes, updated, state.map_view, screen_dim);
+            }
+        }
+
+        if ((changes.all || changes.count) && screen_dim.x && screen_dim.y)
+        {
+            render_frame(state, camera, screen_dim, changes);
+        }
+
+        state.n_files_shown += n_written;
+        state.n_files_processed += n_images;
+
+        if (save_map_requested)
+        {
+            save_map();
+        }
+
+        if (save_screens_requested)
+        {
+            save_screens();
+        }
+    }
 }
 
 
@@ -595,35 +4934,99 @@ static void main_loop()
 {
     auto const monitor_images = []()
     {
-        monitor_image_directory(state.h_watch_dir, state.image_list);
+        monitor_image_directory(state.watch, state.image_queue);
+    };
+
+    auto const decode = []()
+    {
+        decode_images(state.settings, state.image_queue, state.control);
+    };
+
+    auto const process = []()
+    {
+        process_map(state);
     };
 
-    std::thread th(monitor_images);
+    std::thread th_monitor(monitor_images);
+    std::thread th_decode(decode);
+    std::thread th_process(process);
+
+    std::thread th_stream;
+    if (!state.options.stream_path.empty())
+    {
+        th_stream = std::thread([]() { run_frame_stream(state); });
+    }
+
+    std::thread th_video;
+    if (!state.options.video_path.empty())
+    {
+        th_video = std::thread([]() { run_video(state); });
+    }
+
+    pacing::start(state.pacer, TARGET_NS_PER_FRAME);
 
-    Stopwatch sw;
-    sw.start();
+    state.start_time = pacing::Clock::now();
+    state.next_stats_time = state.start_time + std::chrono::seconds(state.settings.stats_interval_sec);
 
     while (is_running())
     {
         process_user_input();
 
-        if (update_map(state.settings, state.image_list, state.map_view))
+        // once per burst of size and mouse events
+        send_view(state);
+
+        show_frame(state.frames, state.screen);
+
+        if (state.options.headless)
+        {
+            // every iteration is a timed frame
+            state.screen.redraw = true;
+            sdl::render_screen(state.screen);
+            pacing::mark_frame(state.pacer);
+
+            if (is_headless_done(state))
+            {
+                end_program();
+            }
+        }
+        else if (sdl::render_screen(state.screen))
         {
-            img::resize(state.map_view, state.screen.view);
+            // a burst of events is presented at most once per frame
+            pacing::wait_for_next_frame(state.pacer);
         }
 
-        sdl::render_screen(state.screen);
+        update_stats();
+    }
+
+    state.image_queue.cv.notify_one();
+    state.control.cv.notify_one();
+
+    th_monitor.join();
+    th_decode.join();
+    th_process.join();
+
+    if (th_stream.joinable())
+    {
+        th_stream.join();
+    }
 
-        cap_framerate(sw, TARGET_NS_PER_FRAME);
+    if (th_video.joinable())
+    {
+        th_video.join();
+    }
+
+    for (auto& image : state.image_queue.images)
+    {
+        img::destroy_image(image);
     }
-    
-    th.join();
 }
 
 
 
-int main()
+int main(int argc, char* argv[])
 {
+    state.options = parse_run_options(argc, argv);
+
     if (!main_init())
     {
         return 1;
@@ -631,12 +5034,21 @@ int main()
 
     state.run_state = RunState::Running;
 
+    auto start = pacing::Clock::now();
+
     main_loop();
 
+    if (state.options.headless)
+    {
+        std::chrono::duration<f64> elapsed = pacing::Clock::now() - start;
+        print_headless_timing(state, elapsed.count());
+    }
+
     main_close();
 
     return 0;
 }
 
 
-#include "../libs/image.cpp"
\ No newline at end of file
+#include "../libs/image.cpp"
+#include "../libs/mip_pyramid.cpp"
\ No newline at end of file